@@ -0,0 +1,323 @@
+#ifndef BLOCK_LOG_H
+#define BLOCK_LOG_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define BLOCK_LOG_BLOCK_SIZE 512
+#define BLOCK_LOG_HEADER 16
+#define BLOCK_LOG_PAYLOAD (BLOCK_LOG_BLOCK_SIZE - BLOCK_LOG_HEADER)
+#define BLOCK_LOG_MAGIC 0x474F4C49UL // "ILOG"
+// Blocks 0 and 1 of the region hold the commit record, data starts after
+#define BLOCK_LOG_DATA 2
+
+// CRC-16/CCITT, over the header fields and the data of a block
+inline uint16_t blockLogCrc(uint16_t crc, const uint8_t *data, uint16_t length) {
+  while (length--) {
+    crc ^= (uint16_t)*data++ << 8;
+    for (uint8_t bit = 0; bit < 8; bit++) crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+// An append-only log written as raw blocks into a region of the card that
+// was allocated up front (e.g. a contiguous file). Appending never touches
+// the FAT, so it takes the same time however large the log is.
+//
+// Every data block carries a header (generation, block index, write sequence,
+// bytes used and a CRC), so a torn write is detected instead of read back as
+// data. The partly filled tail block is never overwritten in place: each
+// sync() writes it alternately to its own slot and to the next, still unused,
+// slot, and the copy with the highest sequence wins. A power cut during a
+// write therefore leaves the previous copy intact. Once a block is full it
+// is written to its own slot and the commit record (two copies, alternately
+// written) is moved on to the next block, so after a reset mount() only has
+// to look at the last block or two.
+//
+// The block device is a policy class with
+//   bool readBlock(uint32_t block, uint8_t *data)
+//   bool writeBlock(uint32_t block, const uint8_t *data)
+// for 512 byte blocks. write() only fills the RAM buffer (writing a block to
+// the device when one fills up); sync() makes everything written so far
+// durable, with a single block write.
+template <class Device>
+class BlockLog {
+  public:
+    BlockLog() : first(0), count(0), ready(false) {}
+
+    // Start a new, empty log in the 'count' blocks from 'first', discarding
+    // whatever was there. The generation is bumped so blocks of an earlier
+    // log in the same region can never be mistaken for new ones
+    bool format(uint32_t first, uint32_t count) {
+      ready = false;
+      if (count < BLOCK_LOG_DATA + 2) return false;
+      this->first = first;
+      this->count = count;
+
+      generation = 0;
+      for (uint8_t slot = 0; slot < BLOCK_LOG_DATA; slot++) {
+        uint32_t tail;
+        if (readCommit(slot, tail) && lastGeneration > generation) generation = lastGeneration;
+      }
+      if (device.readBlock(home(0), buffer) && get32(buffer) > generation) generation = get32(buffer);
+      generation++;
+
+      sequence = 1;
+      tailIndex = 0;
+      tailUsed = 0;
+      durableUsed = 0;
+      latest = SLOT_NONE;
+      commitSlot = 0;
+      ready = writeCommit() && writeCommit();
+      return ready;
+    }
+
+    // Pick up the log in the 'count' blocks from 'first' after a reset.
+    // Returns false if there is no log there (or it can't be read). Check
+    // isBlank() before starting over with format()
+    bool mount(uint32_t first, uint32_t count) {
+      ready = false;
+      if (count < BLOCK_LOG_DATA + 2) return false;
+      this->first = first;
+      this->count = count;
+
+      // The newest valid commit record says where to start looking
+      bool found = false;
+      uint32_t newest = 0;
+      for (uint8_t slot = 0; slot < BLOCK_LOG_DATA; slot++) {
+        uint32_t tail;
+        if (readCommit(slot, tail) && (!found || lastSequence > newest)) {
+          found = true;
+          newest = lastSequence;
+          generation = lastGeneration;
+          tailIndex = tail;
+          commitSlot = slot ^ 1;
+        }
+      }
+      if (!found || tailIndex > dataBlocks()) return false;
+      sequence = newest + 1;
+      tailUsed = 0;
+      durableUsed = 0;
+      latest = SLOT_NONE;
+
+      // Walk over the blocks that filled up after that commit, up to the tail
+      while (tailIndex < dataBlocks()) {
+        uint32_t homeSequence = 0;
+        uint32_t shadowSequence = 0;
+        uint16_t homeUsed = readCopy(home(tailIndex), tailIndex, homeSequence);
+        uint16_t shadowUsed = readCopy(shadow(tailIndex), tailIndex, shadowSequence);
+
+        tailUsed = 0;
+        latest = SLOT_NONE;
+        if (shadowSequence > homeSequence) {
+          tailUsed = shadowUsed;
+          latest = SLOT_SHADOW;
+        }
+        else if (homeSequence > 0) {
+          // The buffer holds the older copy by now, read the newer one again
+          if (readCopy(home(tailIndex), tailIndex, homeSequence) != homeUsed) return false;
+          tailUsed = homeUsed;
+          latest = SLOT_HOME;
+        }
+        durableUsed = tailUsed;
+        if (homeSequence >= sequence) sequence = homeSequence + 1;
+        if (shadowSequence >= sequence) sequence = shadowSequence + 1;
+
+        if (tailUsed < BLOCK_LOG_PAYLOAD) break;
+        if (!advance()) return false;
+      }
+      if (latest == SLOT_NONE) memset(buffer, 0, sizeof(buffer));
+      ready = true;
+      return true;
+    }
+
+    // True if neither commit record in the 'count' blocks from 'first' is
+    // valid, so format() can't throw a log away. A block that can't be read
+    // might hold one, so that isn't blank
+    bool isBlank(uint32_t first, uint32_t count) {
+      ready = false;
+      if (count < BLOCK_LOG_DATA + 2) return false;
+      this->first = first;
+      this->count = count;
+      for (uint8_t slot = 0; slot < BLOCK_LOG_DATA; slot++) {
+        uint32_t tail;
+        if (!device.readBlock(first + slot, buffer) || isCommit(tail)) return false;
+      }
+      return true;
+    }
+
+    // Append data to the log. Returns the number of bytes taken, which is
+    // less than 'length' once the log is full or the card stops responding
+    uint16_t write(const uint8_t *data, uint16_t length) {
+      uint16_t written = 0;
+      while (ready && written < length && tailIndex < dataBlocks()) {
+        uint16_t part = BLOCK_LOG_PAYLOAD - tailUsed;
+        if (part > length - written) part = length - written;
+        memcpy(buffer + BLOCK_LOG_HEADER + tailUsed, data + written, part);
+        tailUsed += part;
+        written += part;
+        if (tailUsed == BLOCK_LOG_PAYLOAD && !advance()) ready = false;
+      }
+      return written;
+    }
+
+    // Make everything written so far survive a power cut
+    bool sync() {
+      if (!ready) return false;
+      if (tailUsed == durableUsed) return true;
+      return writeTail(latest == SLOT_HOME ? SLOT_SHADOW : SLOT_HOME);
+    }
+
+    // Read back data block 'index' (the newest copy, as mount() would see
+    // it) into 'block'. Returns the number of bytes of data, which start at
+    // block + BLOCK_LOG_HEADER, or 0 if the block holds nothing
+    uint16_t read(uint32_t index, uint8_t *block) {
+      uint32_t homeSequence = 0;
+      uint32_t shadowSequence = 0;
+      if (index >= dataBlocks()) return 0;
+      readCopy(home(index), index, homeSequence, block);
+      uint16_t shadowUsed = readCopy(shadow(index), index, shadowSequence, block);
+      if (shadowSequence > homeSequence) return shadowUsed;
+      return homeSequence > 0 ? readCopy(home(index), index, homeSequence, block) : 0;
+    }
+
+    // Bytes in the log (including any not synced yet)
+    uint32_t size() const {
+      return tailIndex * BLOCK_LOG_PAYLOAD + tailUsed;
+    }
+
+    // Bytes the region can hold
+    uint32_t capacity() const {
+      return dataBlocks() * BLOCK_LOG_PAYLOAD;
+    }
+
+    bool isReady() const {
+      return ready;
+    }
+
+    Device device;
+
+  private:
+    enum { SLOT_NONE, SLOT_HOME, SLOT_SHADOW };
+
+    static uint32_t get32(const uint8_t *in) {
+      return in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+    }
+
+    static void put32(uint8_t *out, uint32_t value) {
+      out[0] = value;
+      out[1] = value >> 8;
+      out[2] = value >> 16;
+      out[3] = value >> 24;
+    }
+
+    // The last block can only ever be the spare slot of the one before it
+    uint32_t dataBlocks() const {
+      return count - BLOCK_LOG_DATA - 1;
+    }
+
+    uint32_t home(uint32_t index) const {
+      return first + BLOCK_LOG_DATA + index;
+    }
+
+    uint32_t shadow(uint32_t index) const {
+      return home(index + 1);
+    }
+
+    // Write the tail block (header and all) to one of its two slots
+    bool writeTail(uint8_t slot) {
+      put32(buffer, generation);
+      put32(buffer + 4, tailIndex);
+      put32(buffer + 8, sequence);
+      buffer[12] = tailUsed;
+      buffer[13] = tailUsed >> 8;
+      uint16_t crc = blockLogCrc(0xFFFF, buffer, 14);
+      crc = blockLogCrc(crc, buffer + BLOCK_LOG_HEADER, tailUsed);
+      buffer[14] = crc;
+      buffer[15] = crc >> 8;
+      if (!device.writeBlock(slot == SLOT_HOME ? home(tailIndex) : shadow(tailIndex), buffer)) return false;
+      sequence++;
+      latest = slot;
+      durableUsed = tailUsed;
+      return true;
+    }
+
+    // The tail block is full: get it into its own slot, keeping a good copy
+    // around while that slot is rewritten, then start on the next block
+    bool advance() {
+      if (latest != SLOT_HOME || durableUsed < BLOCK_LOG_PAYLOAD) {
+        if (latest == SLOT_HOME && !writeTail(SLOT_SHADOW)) return false;
+        if (!writeTail(SLOT_HOME)) return false;
+      }
+      tailIndex++;
+      tailUsed = 0;
+      durableUsed = 0;
+      latest = SLOT_NONE;
+      return writeCommit();
+    }
+
+    // Uses the block buffer, so only while the tail is empty
+    bool writeCommit() {
+      memset(buffer, 0, sizeof(buffer));
+      put32(buffer, BLOCK_LOG_MAGIC);
+      put32(buffer + 4, generation);
+      put32(buffer + 8, tailIndex);
+      put32(buffer + 12, sequence);
+      uint16_t crc = blockLogCrc(0xFFFF, buffer, 16);
+      buffer[16] = crc;
+      buffer[17] = crc >> 8;
+      bool written = device.writeBlock(first + commitSlot, buffer);
+      memset(buffer, 0, sizeof(buffer));
+      if (!written) return false;
+      sequence++;
+      commitSlot ^= 1;
+      return true;
+    }
+
+    bool readCommit(uint8_t slot, uint32_t &tail) {
+      return device.readBlock(first + slot, buffer) && isCommit(tail);
+    }
+
+    // Whether the buffer holds a valid commit record
+    bool isCommit(uint32_t &tail) {
+      if (get32(buffer) != BLOCK_LOG_MAGIC) return false;
+      if (blockLogCrc(0xFFFF, buffer, 16) != (buffer[16] | (uint16_t)buffer[17] << 8)) return false;
+      lastGeneration = get32(buffer + 4);
+      tail = get32(buffer + 8);
+      lastSequence = get32(buffer + 12);
+      return true;
+    }
+
+    // Read a copy of data block 'index' from 'block'. Returns the bytes used
+    // and sets 'copySequence', which stays 0 if the copy isn't valid
+    uint16_t readCopy(uint32_t block, uint32_t index, uint32_t &copySequence) {
+      return readCopy(block, index, copySequence, buffer);
+    }
+
+    uint16_t readCopy(uint32_t block, uint32_t index, uint32_t &copySequence, uint8_t *data) {
+      copySequence = 0;
+      if (!device.readBlock(block, data)) return 0;
+      uint16_t used = data[12] | (uint16_t)data[13] << 8;
+      if (get32(data) != generation || get32(data + 4) != index || used > BLOCK_LOG_PAYLOAD) return 0;
+      uint16_t crc = blockLogCrc(0xFFFF, data, 14);
+      if (blockLogCrc(crc, data + BLOCK_LOG_HEADER, used) != (data[14] | (uint16_t)data[15] << 8)) return 0;
+      copySequence = get32(data + 8);
+      return used;
+    }
+
+    uint32_t first;
+    uint32_t count;
+    uint32_t generation;
+    uint32_t sequence;
+    uint32_t tailIndex;
+    uint16_t tailUsed;
+    uint16_t durableUsed;
+    uint8_t latest;
+    uint8_t commitSlot;
+    bool ready;
+    uint32_t lastGeneration;
+    uint32_t lastSequence;
+    uint8_t buffer[BLOCK_LOG_BLOCK_SIZE];
+};
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#include <stdint.h>
+#include <irrigation.h>
+#include <trace.h>
+
+// Plot valve relays are on pins 22 - 35 (plot 1 on 22), the master
+// valve/pump relay on 36. The relays use reverse logic: LOW opens
+#define CONTROLLER_RELAY_PIN(zone) ((zone) + 21)
+#define CONTROLLER_MASTER_PIN 36
+
+// Longest time (in seconds) idle() waits before checking the clock again
+#define CONTROLLER_MAX_IDLE_SECONDS 60
+// How often (in milliseconds) the flow meter pulses are collected while idle
+#define CONTROLLER_FLOW_POLL_MS 250
+// Time (in milliseconds) the moisture sensors get to settle before reading
+#define CONTROLLER_SENSOR_SETTLE_MS 10
+
+// Runs the Irrigation decisions against the hardware: takes the readings,
+// switches the relays, collects the flow meter pulses and waits for the next
+// event. The hardware is a policy class, so on the Mega every call inlines
+// down to the register access and a simulated or mocked policy runs the exact
+// same code in the native env. A policy provides:
+//
+//   GPIO         void outputPin(uint8_t pin)
+//                void writePin(uint8_t pin, bool high)
+//                void commitPins()
+//   ADC          int16_t readMoisture(uint8_t zone)
+//   environment  void readEnvironment(float &humidity, float &temperature)
+//   clock        uint32_t now()                  RTC seconds since 2000-01-01
+//                void sleep(uint16_t ms)
+//   storage      static const bool TRACE
+//                void store(const uint8_t *record, uint8_t length)
+//   fast zones   void writeRelays(uint16_t zones, uint16_t open)
+//
+// writePin() may only stage the change, commitPins() then switches every
+// staged pin at once. The controller commits once all events that are due
+// have been carried out (and before taking readings), so a zone closing and
+// the next one opening switch in the same instant. A policy that writes
+// straight away has an empty commitPins().
+//
+// store() appends a trace record (see trace.h) and is only called when TRACE
+// is true, so a policy that doesn't trace costs nothing.
+//
+// writeRelays() switches the plot relays set in 'zones' (bit n for plot n)
+// to the state in 'open' right away. It is called from the timer interrupt
+// that runs fastTick(), and only needed by a policy that runs fast zones.
+//
+// The sketch reaches the rest of the board (serial port, LEDs, SD card)
+// through 'hardware' as well, so the board policy carries those calls too.
+// The controller itself never makes them.
+template <class Hardware>
+class Controller {
+  public:
+    Controller() : seconds(0), polling(false), passTraced(false) {}
+
+    // Close every valve, then start the schedule with the settings made on
+    // 'irrigation'. The first readings are due right away
+    void begin() {
+      for (uint8_t zone = 1; zone <= IRRIGATION_MAX_ZONES; zone++) {
+        hardware.writePin(CONTROLLER_RELAY_PIN(zone), true);
+      }
+      hardware.writePin(CONTROLLER_MASTER_PIN, true);
+      hardware.commitPins();
+      for (uint8_t zone = 1; zone <= IRRIGATION_MAX_ZONES; zone++) {
+        hardware.outputPin(CONTROLLER_RELAY_PIN(zone));
+      }
+      hardware.outputPin(CONTROLLER_MASTER_PIN);
+
+      seconds = hardware.now();
+      irrigation.begin(seconds);
+      if (Hardware::TRACE) trace(traceBegin(record, seconds, irrigation));
+    }
+
+    // Carry out the next event that is due: open or close a valve, or take a
+    // set of readings and work through them. The event is handed back for
+    // printing and logging. Returns false once nothing more is due, after
+    // which idle() waits for the next event
+    bool step(ScheduleEvent &event) {
+      if (!polling) {
+        seconds = hardware.now();
+        serviceFlow(seconds);
+        polling = true;
+        passTraced = false;
+      }
+      if (!irrigation.poll(seconds, event)) {
+        hardware.commitPins();
+        polling = false;
+        return false;
+      }
+      if (Hardware::TRACE && !passTraced) {
+        trace(tracePass(record, seconds));
+        passTraced = true;
+      }
+
+      switch (event.type) {
+        case EVENT_SAMPLE: {
+          RawInputs inputs;
+          hardware.commitPins();
+          readInputs(inputs, event.at);
+          if (Hardware::TRACE) trace(traceInputs(record, inputs, irrigation.zones()));
+          irrigation.sample(inputs);
+          return true;
+        }
+        case EVENT_MASTER_OPEN:
+          hardware.writePin(CONTROLLER_MASTER_PIN, false);
+          break;
+        case EVENT_ZONE_OPEN:
+          hardware.writePin(CONTROLLER_RELAY_PIN(event.zone), false);
+          break;
+        case EVENT_ZONE_CLOSE:
+          hardware.writePin(CONTROLLER_RELAY_PIN(event.zone), true);
+          break;
+        case EVENT_MASTER_CLOSE:
+          hardware.writePin(CONTROLLER_MASTER_PIN, true);
+          break;
+      }
+      if (Hardware::TRACE) trace(traceDecision(record, event));
+      return true;
+    }
+
+    // Wait until the next event is due, collecting the flow meter pulses in
+    // the meantime. The wait is capped so the clock gets checked regularly,
+    // and ends early once a zone has received its target volume
+    void idle() {
+      uint32_t due = irrigation.schedule.nextDue();
+      if (due <= seconds) return;
+      uint32_t wait = due - seconds;
+      if (wait > CONTROLLER_MAX_IDLE_SECONDS) wait = CONTROLLER_MAX_IDLE_SECONDS;
+      for (uint32_t slept = 0; slept < wait * 1000; slept += CONTROLLER_FLOW_POLL_MS) {
+        hardware.sleep(CONTROLLER_FLOW_POLL_MS);
+        if (serviceFlow(seconds + slept / 1000)) return;
+      }
+    }
+
+    // Switch the fast zones (see fast_control.h). Called from a timer
+    // interrupt every FAST_TICK_US with the time in microseconds
+    void fastTick(uint32_t us) {
+      if (irrigation.fast.tick(us)) hardware.writeRelays(irrigation.fast.zones(), irrigation.fast.openZones());
+    }
+
+    Irrigation irrigation;
+    Hardware hardware;
+
+  private:
+    // Credit the pulses counted since the last call to the open zone.
+    // Returns true when that zone is now due to be closed
+    bool serviceFlow(uint32_t now) {
+      uint16_t pulses[FLOW_MAX_METERS];
+      if (!irrigation.flow.drain(pulses)) return false;
+      if (Hardware::TRACE) trace(traceFlow(record, now, pulses));
+      return irrigation.meter(now, pulses);
+    }
+
+    void readInputs(RawInputs &inputs, uint32_t at) {
+      inputs.at = at;
+      hardware.readEnvironment(inputs.humidity, inputs.temperature);
+      hardware.sleep(CONTROLLER_SENSOR_SETTLE_MS);
+      for (uint8_t zone = 0; zone <= IRRIGATION_MAX_ZONES; zone++) {
+        inputs.sensorValue[zone] = zone >= 1 && zone <= irrigation.zones() ? hardware.readMoisture(zone) : 0;
+      }
+    }
+
+    void trace(uint8_t length) {
+      hardware.store(record, length);
+    }
+
+    uint32_t seconds;
+    bool polling;
+    bool passTraced;
+    uint8_t record[TRACE_MAX_RECORD];
+};
+
+#endif
@@ -0,0 +1,27 @@
+// The catalog of events the controller reports, included by events.h and
+// events.cpp and read by tools/decode_events.py. The ID of an event is its
+// position in this list (starting at 1), so only ever add events at the end.
+//
+// EVENT(name, signature, template)
+//
+// The signature lists the arguments in order, one character each:
+//   B uint8_t, H uint16_t, I uint32_t, f float, F fault code (uint8_t)
+// The template refers to them as {0}, {1}, ... and has to stay on one line.
+
+EVENT(RTC_NOT_RUNNING,   "",      "RTC is NOT running!")
+EVENT(RTC_STARTED,       "",      "Real time clock initialized.")
+EVENT(SD_FAILED,         "",      "Card failed, or not present. WARNING: NO DATA WILL BE COLLECTED! CHECK CARD AND ALL CONNECTIONS TO SD SHIELD")
+EVENT(SD_STARTED,        "",      "SD card initialized.")
+EVENT(DATA_FILE_FAILED,  "",      "error opening data file")
+EVENT(TRACE_FILE_FAILED, "",      "error opening trace file trace.bin")
+EVENT(DHT_FAILED,        "",      "Failed to read from DHT")
+EVENT(SENSOR_LOW,        "Bf",    "WARNING: Sensor {0} out of range (too low). Current reading: {1} m3/m3")
+EVENT(SENSOR_HIGH,       "Bf",    "WARNING: Sensor {0} out of range (too high). Current reading: {1} m3/m3")
+EVENT(LEAK,              "f",     "WARNING: {0} L of water flowed while all valves were closed. Check for a stuck valve or leak.")
+EVENT(PLOT_DISABLED,     "BF",    "WARNING: Plot {0} disabled: {1}")
+EVENT(ENVIRONMENT,       "fffff", "Humidity: {0}%, Temperature: {1} *C, e_sat: {2} kPa, e: {3} kPa, VPD: {4} kPa")
+EVENT(PLOT_READING,      "BfHf",  "Plot #{0}: VWC {1} m3/m3, {2} irrigations, {3} L delivered")
+EVENT(ZONE_STARTED,      "B",     "Plot {0} irrigation started.")
+EVENT(ZONE_FINISHED,     "Bf",    "Plot {0} irrigation finished. Water delivered: {1} L")
+EVENT(FAST_TIMING,       "IIHH",  "Fast zones: {0} switches, {1} missed deadlines, lateness max {2} us, mean {3} us")
+EVENT(BAD_EVENT,         "B",     "Event {0} was reported with arguments that don't match the catalog")
@@ -0,0 +1,183 @@
+#include <events.h>
+#include <fault_detector.h>
+
+#define EVENT(name, signature, text) \
+  static const char name##_SIGNATURE[] PROGMEM = signature; \
+  static const char name##_TEXT[] PROGMEM = text;
+#include <event_catalog.h>
+#undef EVENT
+
+struct EventInfo {
+  const char *signature;
+  const char *text;
+};
+
+static const EventInfo CATALOG[] PROGMEM = {
+  { NULL, NULL },
+#define EVENT(name, signature, text) { name##_SIGNATURE, name##_TEXT },
+#include <event_catalog.h>
+#undef EVENT
+};
+
+// Signature and template of an event, both in PROGMEM. NULL for unknown IDs
+const char *eventSignature(uint8_t id) {
+  return id > EV_NONE && id < EV_COUNT ? EVENT_READ_PTR(&CATALOG[id].signature) : NULL;
+}
+
+const char *eventTemplate(uint8_t id) {
+  return id > EV_NONE && id < EV_COUNT ? EVENT_READ_PTR(&CATALOG[id].text) : NULL;
+}
+
+uint8_t eventBegin(uint8_t *record, uint8_t id, uint32_t at) {
+  if (eventSignature(id) == NULL) return 0;
+  record[0] = EVENT_MARKER;
+  record[1] = id;
+  for (uint8_t i = 0; i < 4; i++, at >>= 8) record[2 + i] = at;
+  return EVENT_HEADER;
+}
+
+static uint8_t checksum(const uint8_t *record, uint8_t length) {
+  uint8_t sum = 0;
+  for (uint8_t i = 1; i < length; i++) sum += record[i];
+  return sum;
+}
+
+uint8_t eventEnd(uint8_t *record, uint8_t length) {
+  record[length] = checksum(record, length);
+  return length + 1;
+}
+
+// Fill 'record' with an EV_BAD_EVENT for event 'id'
+uint8_t eventBad(uint8_t *record, uint8_t id, uint32_t at) {
+  eventBegin(record, EV_BAD_EVENT, at);
+  record[EVENT_HEADER] = id;
+  return eventEnd(record, EVENT_HEADER + 1);
+}
+
+static uint8_t argumentSize(char type) {
+  switch (type) {
+    case 'B':
+    case 'F': return 1;
+    case 'H': return 2;
+    case 'I':
+    case 'f': return 4;
+  }
+  return 0;
+}
+
+// Check the record at the start of 'data'. Returns its length, or 0 if it
+// isn't a valid record (wrong marker, unknown event, cut short or a bad
+// checksum), in which case a reader skips a byte and tries again
+uint8_t readEvent(const uint8_t *data, uint16_t length) {
+  if (length < EVENT_HEADER + 1 || data[0] != EVENT_MARKER) return 0;
+  const char *signature = eventSignature(data[1]);
+  if (signature == NULL) return 0;
+
+  uint8_t size = EVENT_HEADER;
+  for (char type; (type = pgm_read_byte(signature)) != 0; signature++) size += argumentSize(type);
+  if (length < size + 1 || data[size] != checksum(data, size)) return 0;
+  return size + 1;
+}
+
+static uint32_t getBits(const uint8_t *in, uint8_t size) {
+  uint32_t bits = 0;
+  for (uint8_t i = size; i > 0; i--) bits = bits << 8 | in[i - 1];
+  return bits;
+}
+
+static const char NAN_TEXT[] PROGMEM = "nan";
+static const char OVERFLOW_TEXT[] PROGMEM = "ovf";
+
+// Append 'word' (in PROGMEM) to 'text', cut short to fit 'size' and always
+// terminated
+static uint8_t formatWord(char *text, uint8_t size, const char *word) {
+  uint8_t length = 0;
+  for (char c; (c = pgm_read_byte(word)) != 0 && length < size - 1; word++) text[length++] = c;
+  text[length] = 0;
+  return length;
+}
+
+// Append 'value' to 'text', Serial.print() style: two decimals
+static uint8_t formatFloat(char *text, uint8_t size, float value) {
+  char digits[16];
+  uint8_t length = 0;
+  if (value != value) return formatWord(text, size, NAN_TEXT);
+  if (value < 0) {
+    digits[length++] = '-';
+    value = -value;
+  }
+  if (value > 4294967040.0) return formatWord(text, size, OVERFLOW_TEXT);
+  uint32_t whole = value + 0.005;
+  uint8_t hundredths = (value + 0.005 - whole) * 100;
+  char reversed[10];
+  uint8_t count = 0;
+  do {
+    reversed[count++] = '0' + whole % 10;
+    whole /= 10;
+  } while (whole > 0);
+  while (count > 0) digits[length++] = reversed[--count];
+  digits[length++] = '.';
+  digits[length++] = '0' + hundredths / 10;
+  digits[length++] = '0' + hundredths % 10;
+  if (length >= size) length = size - 1;
+  memcpy(text, digits, length);
+  text[length] = 0;
+  return length;
+}
+
+static uint8_t formatUnsigned(char *text, uint8_t size, uint32_t value) {
+  char reversed[10];
+  uint8_t count = 0;
+  uint8_t length = 0;
+  do {
+    reversed[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0);
+  while (count > 0 && length < size - 1) text[length++] = reversed[--count];
+  text[length] = 0;
+  return length;
+}
+
+// Turn a valid record into its message, filling in the arguments. Returns
+// the length of the text, which is cut short to fit 'size'
+uint8_t renderEvent(const uint8_t *record, char *text, uint8_t size) {
+  const char *signature = eventSignature(record[1]);
+  const char *format = eventTemplate(record[1]);
+  uint8_t length = 0;
+  text[0] = 0;
+  if (format == NULL || size == 0) return 0;
+
+  for (char c; (c = pgm_read_byte(format)) != 0 && length < size - 1; format++) {
+    uint8_t argument = pgm_read_byte(format + 1) - '0';
+    if (c != '{' || argument > 9 || pgm_read_byte(format + 2) != '}') {
+      text[length++] = c;
+      continue;
+    }
+    format += 2;
+
+    // Find the argument in the record
+    const uint8_t *value = record + EVENT_HEADER;
+    char type = 0;
+    for (uint8_t i = 0; i <= argument; i++) {
+      if (i > 0) value += argumentSize(type);
+      type = pgm_read_byte(signature + i);
+      if (type == 0) break;
+    }
+    if (type == 0) continue;
+
+    if (type == 'f') {
+      uint32_t bits = getBits(value, 4);
+      float number;
+      memcpy(&number, &bits, 4);
+      length += formatFloat(text + length, size - length, number);
+    }
+    else if (type == 'F') {
+      length += formatWord(text + length, size - length, FaultDetector::name(*value));
+    }
+    else {
+      length += formatUnsigned(text + length, size - length, getBits(value, argumentSize(type)));
+    }
+  }
+  text[length] = 0;
+  return length;
+}
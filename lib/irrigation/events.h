@@ -0,0 +1,133 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+#include <string.h>
+
+// The catalog lives in flash on the Mega
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#define EVENT_READ_PTR(address) ((const char *)pgm_read_word(address))
+#else
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#ifndef pgm_read_byte
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#endif
+#define EVENT_READ_PTR(address) (*(const char * const *)(address))
+#endif
+
+// An event record is the marker, the event ID, the RTC time (seconds since
+// 2000-01-01), the arguments as listed in the catalog and a checksum (the
+// low byte of the sum of everything after the marker). Multi-byte values
+// are little endian, floats are stored as their raw IEEE bits.
+#define EVENT_MARKER 0xE7
+#define EVENT_HEADER 6
+#define EVENT_MAX_RECORD 32
+// Longest rendered message, including the terminating 0
+#define EVENT_MAX_TEXT 128
+
+enum EventId {
+  EV_NONE,
+#define EVENT(name, signature, text) EV_##name,
+#include <event_catalog.h>
+#undef EVENT
+  EV_COUNT
+};
+
+const char *eventSignature(uint8_t id);
+const char *eventTemplate(uint8_t id);
+uint8_t eventBegin(uint8_t *record, uint8_t id, uint32_t at);
+uint8_t eventEnd(uint8_t *record, uint8_t length);
+uint8_t readEvent(const uint8_t *data, uint16_t length);
+uint8_t renderEvent(const uint8_t *record, char *text, uint8_t size);
+
+uint8_t eventBad(uint8_t *record, uint8_t id, uint32_t at);
+
+// The signatures again, for checking the arguments at compile time. Only
+// read by static_assert, so none of it ends up in the program
+constexpr const char *const EVENT_SIGNATURES[] = {
+  "",
+#define EVENT(name, signature, text) signature,
+#include <event_catalog.h>
+#undef EVENT
+};
+
+// Which signature characters a C++ type may be stored as. Only the exact
+// types listed in the catalog are, an int or a double has to be cast
+template <class T> struct EventArg {
+  static constexpr bool fits(char) { return false; }
+};
+template <> struct EventArg<uint8_t> {
+  static constexpr bool fits(char type) { return type == 'B' || type == 'F'; }
+};
+template <> struct EventArg<uint16_t> {
+  static constexpr bool fits(char type) { return type == 'H'; }
+};
+template <> struct EventArg<uint32_t> {
+  static constexpr bool fits(char type) { return type == 'I'; }
+};
+template <> struct EventArg<float> {
+  static constexpr bool fits(char type) { return type == 'f'; }
+};
+
+// Whether the argument types match 'signature', one for one
+template <class... Args> struct EventArgs;
+template <> struct EventArgs<> {
+  static constexpr bool fit(const char *signature) { return *signature == 0; }
+};
+template <class T, class... Rest> struct EventArgs<T, Rest...> {
+  static constexpr bool fit(const char *signature) {
+    return *signature != 0 && EventArg<T>::fits(*signature) && EventArgs<Rest...>::fit(signature + 1);
+  }
+};
+
+// Store one argument of type 'type' (a signature character). Returns its
+// size, or 0 if the value doesn't match the type
+template <class T>
+inline uint8_t eventPut(uint8_t *out, char type, T value) {
+  if (!EventArg<T>::fits(type)) return 0;
+  uint32_t bits = value;
+  for (uint8_t i = 0; i < sizeof(T); i++, bits >>= 8) out[i] = bits;
+  return sizeof(T);
+}
+
+inline uint8_t eventPut(uint8_t *out, char type, float value) {
+  if (type != 'f') return 0;
+  memcpy(out, &value, 4);
+  return 4;
+}
+
+inline uint8_t eventArgs(uint8_t *record, uint8_t length, const char *signature) {
+  return pgm_read_byte(signature) == 0 ? eventEnd(record, length) : 0;
+}
+
+template <class T, class... Rest>
+uint8_t eventArgs(uint8_t *record, uint8_t length, const char *signature, T value, Rest... rest) {
+  uint8_t size = eventPut(record + length, pgm_read_byte(signature), value);
+  if (size == 0) return 0;
+  return eventArgs(record, length + size, signature + 1, rest...);
+}
+
+// Fill 'record' (at least EVENT_MAX_RECORD bytes) with event 'id' and its
+// arguments. Returns the length of the record. If 'id' is unknown or the
+// arguments don't match its signature in the catalog, the record is an
+// EV_BAD_EVENT carrying 'id' instead, so the mistake still shows up
+template <class... Args>
+uint8_t encodeEvent(uint8_t *record, uint8_t id, uint32_t at, Args... args) {
+  uint8_t length = 0;
+  if (eventBegin(record, id, at) != 0) length = eventArgs(record, EVENT_HEADER, eventSignature(id), args...);
+  return length != 0 ? length : eventBad(record, id, at);
+}
+
+// The same for an 'id' known at compile time, e.g. encodeEvent<EV_LEAK>(record,
+// at, liters). Arguments that don't match the catalog don't compile
+template <EventId id, class... Args>
+uint8_t encodeEvent(uint8_t *record, uint32_t at, Args... args) {
+  static_assert(id > EV_NONE && id < EV_COUNT, "unknown event");
+  static_assert(EventArgs<Args...>::fit(EVENT_SIGNATURES[id]), "the arguments don't match the event's signature in event_catalog.h");
+  return encodeEvent(record, id, at, args...);
+}
+
+#endif
@@ -0,0 +1,150 @@
+#include <fast_control.h>
+
+FastControl::FastControl() {
+  fastZones = 0;
+  openMask = 0;
+  running = false;
+  aligned = false;
+  for (uint8_t zone = 0; zone <= SCHEDULE_MAX_ZONES; zone++) {
+    cycles[zone].periodUs = 0;
+    cycles[zone].openUs = 0;
+    cycles[zone].cycleUs = 0;
+    cycles[zone].open = false;
+    cycles[zone].held = false;
+  }
+  resetStats();
+}
+
+// Run 'zone' as a fast zone: open every 'periodMs' (10 - 100 ms) for
+// 'openMs'. Returns false if the timing can't be done
+bool FastControl::setZone(uint8_t zone, uint16_t periodMs, uint16_t openMs) {
+  if (zone < 1 || zone > SCHEDULE_MAX_ZONES) return false;
+  if (periodMs < FAST_MIN_PERIOD_MS || periodMs > FAST_MAX_PERIOD_MS || openMs == 0 || openMs >= periodMs) return false;
+  cycles[zone].periodUs = periodMs * 1000UL;
+  cycles[zone].openUs = openMs * 1000UL;
+  cycles[zone].open = false;
+  fastZones |= 1 << zone;
+  // Start in step with the other zones on the next tick
+  aligned = false;
+  return true;
+}
+
+// Hand a zone back to the schedule. The interrupt no longer writes its relay,
+// so call it before start() or after stop() and a tick. To take a zone out of
+// service while running, hold() it
+void FastControl::clearZone(uint8_t zone) {
+  if (zone < 1 || zone > SCHEDULE_MAX_ZONES) return;
+  fastZones &= ~(1 << zone);
+  openMask &= ~(1 << zone);
+  cycles[zone].open = false;
+}
+
+// Keep 'zone' closed from the next tick on, or let it cycle again
+void FastControl::hold(uint8_t zone, bool held) {
+  if (zone >= 1 && zone <= SCHEDULE_MAX_ZONES) cycles[zone].held = held;
+}
+
+// Start cycling. Every zone opens on the first tick, so the cycles line up
+// with the timer
+void FastControl::start() {
+  running = true;
+  aligned = false;
+}
+
+// Stop cycling. The fast zones are closed on the next tick
+void FastControl::stop() {
+  running = false;
+  for (uint8_t zone = 1; zone <= SCHEDULE_MAX_ZONES; zone++) cycles[zone].open = false;
+}
+
+// Interrupt side: switch every fast zone that is due at 'nowUs' (micros()).
+// Returns true when the open zones changed and need writing to the relays
+bool FastControl::tick(uint32_t nowUs) {
+  uint16_t before = openMask;
+  if (!running) {
+    openMask = 0;
+    return before != 0;
+  }
+
+  for (uint8_t zone = 1; zone <= SCHEDULE_MAX_ZONES; zone++) {
+    if (!(fastZones & (1 << zone))) continue;
+    FastZone &cycle = cycles[zone];
+    if (!aligned || cycle.held) {
+      // A held zone opens on the first tick after it is released
+      cycle.cycleUs = nowUs + (cycle.held ? FAST_TICK_US : 0);
+      cycle.open = false;
+    }
+
+    while (!cycle.held) {
+      uint32_t due = cycle.open ? cycle.cycleUs + cycle.openUs : cycle.cycleUs;
+      if ((int32_t)(nowUs - due) < 0) break;
+      uint32_t late = nowUs - due;
+      if (late >= cycle.periodUs) {
+        // Whole cycles went by without a tick, skip them
+        uint32_t skipped = late / cycle.periodUs;
+        cycle.cycleUs += skipped * cycle.periodUs;
+        timing.missed += 2 * skipped;
+        continue;
+      }
+      if (!cycle.open && late >= cycle.openUs) {
+        // Too late to open, the pulse would have to close again straight away
+        cycle.cycleUs += cycle.periodUs;
+        timing.missed += 2;
+        continue;
+      }
+      edge(late);
+      if (cycle.open) cycle.cycleUs += cycle.periodUs;
+      cycle.open = !cycle.open;
+    }
+
+    if (cycle.open) openMask |= 1 << zone;
+    else openMask &= ~(1 << zone);
+  }
+  aligned = true;
+  return openMask != before;
+}
+
+void FastControl::edge(uint32_t lateUs) {
+  timing.switches++;
+  if (lateUs >= FAST_DEADLINE_US) {
+    timing.missed++;
+    return;
+  }
+  timing.onTime++;
+  timing.totalLateUs += lateUs;
+  if (lateUs > timing.maxLateUs) timing.maxLateUs = lateUs;
+}
+
+bool FastControl::isFast(uint8_t zone) const {
+  return zone <= SCHEDULE_MAX_ZONES && (fastZones & (1 << zone));
+}
+
+bool FastControl::isHeld(uint8_t zone) const {
+  return zone <= SCHEDULE_MAX_ZONES && cycles[zone].held;
+}
+
+// Bit n is set for every fast zone n
+uint16_t FastControl::zones() const {
+  return fastZones;
+}
+
+// Bit n is set for every fast zone n that is open right now
+uint16_t FastControl::openZones() const {
+  return openMask;
+}
+
+bool FastControl::isRunning() const {
+  return running;
+}
+
+void FastControl::stats(FastStats &out) const {
+  out = timing;
+}
+
+void FastControl::resetStats() {
+  timing.switches = 0;
+  timing.onTime = 0;
+  timing.missed = 0;
+  timing.totalLateUs = 0;
+  timing.maxLateUs = 0;
+}
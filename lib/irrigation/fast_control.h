@@ -0,0 +1,84 @@
+#ifndef FAST_CONTROL_H
+#define FAST_CONTROL_H
+
+#include <stdint.h>
+#include <schedule.h>
+
+// tick() is called from a timer interrupt every FAST_TICK_US. Zones cycle
+// at 10 - 100 Hz, i.e. every FAST_MIN_PERIOD_MS - FAST_MAX_PERIOD_MS
+#define FAST_TICK_US 1000UL
+#define FAST_MIN_PERIOD_MS 10
+#define FAST_MAX_PERIOD_MS 100
+// A valve switched this late (or later) missed its deadline: its tick
+// didn't get to run in time
+#define FAST_DEADLINE_US FAST_TICK_US
+
+// Timing of the fast zones since start() or resetStats()
+struct FastStats {
+  uint32_t switches;    // valve edges carried out
+  uint32_t onTime;      // of which made their deadline
+  uint32_t missed;      // edges switched FAST_DEADLINE_US or more late, or skipped (2 per pulse)
+  uint32_t totalLateUs; // summed lateness of the edges that made their deadline
+  uint16_t maxLateUs;   // worst lateness of an edge that made its deadline
+};
+
+struct FastZone {
+  uint32_t periodUs;
+  uint32_t openUs;
+  uint32_t cycleUs;     // start of the current cycle, when the valve opens
+  bool open;
+  bool held;            // kept closed, e.g. through a blackout
+};
+
+// Runs mist and ebb-and-flow zones that need sub-second valve timing. A fast
+// zone opens every 'period' milliseconds and stays open for 'open'
+// milliseconds, switched from a 1 kHz timer interrupt instead of the
+// schedule. The other zones stay on the normal cycle, and the sample no
+// longer asks for water for a fast zone.
+//
+// Every edge has a fixed due time, so a late tick never shifts the cycle: a
+// late open makes that pulse shorter, a late close makes it longer, and
+// pulses the interrupt didn't get to open before they were due to close are
+// skipped and counted as missed. How late every edge was switched is kept in
+// the statistics.
+//
+// A held zone stays a fast zone but is kept closed, and starts over in step
+// with the timer once it is released. Irrigation holds them during blackouts
+// and while their plot is disabled with a fault.
+//
+// tick() runs in the interrupt. Zones are set up before start() (or with
+// interrupts off), and the main loop copies the statistics and the open
+// zones with interrupts off. hold() only writes a single byte, so it can be
+// called any time.
+class FastControl {
+  public:
+    FastControl();
+
+    bool setZone(uint8_t zone, uint16_t periodMs, uint16_t openMs);
+    void clearZone(uint8_t zone);
+    void hold(uint8_t zone, bool held);
+    void start();
+    void stop();
+
+    bool tick(uint32_t nowUs);
+
+    bool isFast(uint8_t zone) const;
+    bool isHeld(uint8_t zone) const;
+    uint16_t zones() const;
+    uint16_t openZones() const;
+    bool isRunning() const;
+    void stats(FastStats &out) const;
+    void resetStats();
+
+  private:
+    FastZone cycles[SCHEDULE_MAX_ZONES + 1];
+    uint16_t fastZones;
+    uint16_t openMask;
+    bool running;
+    bool aligned;
+    FastStats timing;
+
+    void edge(uint32_t lateUs);
+};
+
+#endif
@@ -0,0 +1,139 @@
+#include <fault_detector.h>
+#include <events.h>
+
+// Weight of the newest reading in the running mean and variance
+#define FAULT_ALPHA 0.125
+
+// The defaults are for VWC in m3/m3. Irrigation sets up its own detector for
+// the scale its readings are on
+FaultDetector::FaultDetector() {
+  flatVariance = 1e-6;
+  flatLimit = 48;
+  minimumRise = 0.02;
+  responseSamples = 2;
+  missedLimit = 3;
+  stepThreshold = 0.15;
+  for (uint8_t zone = 0; zone <= SCHEDULE_MAX_ZONES; zone++) clear(zone);
+}
+
+// A zone is flatlined once the variance of its readings has stayed below
+// 'variance' for 'samples' readings in a row
+void FaultDetector::setFlatline(float variance, uint16_t samples) {
+  flatVariance = variance;
+  flatLimit = samples > 0 ? samples : 1;
+}
+
+// An irrigation has shown up when the VWC rose by at least 'rise' within
+// 'samples' readings. 'missed' irrigations in a row that didn't are a fault
+void FaultDetector::setResponse(float rise, uint8_t samples, uint8_t missed) {
+  minimumRise = rise;
+  responseSamples = samples > 0 ? samples : 1;
+  missedLimit = missed > 0 ? missed : 1;
+}
+
+// Largest change between two readings that isn't treated as a step
+void FaultDetector::setStep(float threshold) {
+  stepThreshold = threshold;
+}
+
+// Feed the latest VWC reading of a zone. Returns the fault the reading
+// tripped, or FAULT_NONE. A zone only ever reports its first fault
+uint8_t FaultDetector::update(uint8_t zone, float vwc) {
+  if (zone < 1 || zone > SCHEDULE_MAX_ZONES) return FAULT_NONE;
+  ZoneHealth &health = zones[zone];
+  if (health.fault != FAULT_NONE) return FAULT_NONE;
+
+  if (health.samples == 0) {
+    health.mean = vwc;
+    health.last = vwc;
+    health.samples = 1;
+    return FAULT_NONE;
+  }
+
+  // A jump is only a fault when the next reading confirms it, a single
+  // glitch is left out of the statistics and forgotten. Irrigation is
+  // allowed to make the reading jump up
+  float from = health.stepPending ? health.stepFrom : health.last;
+  float jump = vwc - from;
+  if (jump < -stepThreshold || (jump > stepThreshold && health.awaiting == 0)) {
+    if (health.stepPending) return trip(health, FAULT_STEP);
+    health.stepPending = true;
+    health.stepFrom = health.last;
+    return FAULT_NONE;
+  }
+  health.stepPending = false;
+
+  float diff = vwc - health.mean;
+  float increment = FAULT_ALPHA * diff;
+  health.mean += increment;
+  health.variance = (1 - FAULT_ALPHA) * (health.variance + diff * increment);
+  if (health.samples < 255) health.samples++;
+
+  if (health.variance < flatVariance) {
+    if (++health.flatSamples >= flatLimit) return trip(health, FAULT_FLATLINE);
+  }
+  else {
+    health.flatSamples = 0;
+  }
+
+  if (health.awaiting > 0) {
+    if (vwc - health.baseline >= minimumRise) {
+      health.awaiting = 0;
+      health.missed = 0;
+    }
+    else if (--health.awaiting == 0 && ++health.missed >= missedLimit) {
+      return trip(health, FAULT_NO_RESPONSE);
+    }
+  }
+
+  health.last = vwc;
+  return FAULT_NONE;
+}
+
+// Tell the detector the zone was just irrigated, so the next readings are
+// expected to go up
+void FaultDetector::irrigated(uint8_t zone) {
+  if (zone < 1 || zone > SCHEDULE_MAX_ZONES) return;
+  ZoneHealth &health = zones[zone];
+  if (health.samples == 0 || health.awaiting > 0) return;
+  health.baseline = health.last;
+  health.awaiting = responseSamples;
+}
+
+bool FaultDetector::isDisabled(uint8_t zone) const {
+  return zone <= SCHEDULE_MAX_ZONES && zones[zone].fault != FAULT_NONE;
+}
+
+uint8_t FaultDetector::fault(uint8_t zone) const {
+  return zone <= SCHEDULE_MAX_ZONES ? zones[zone].fault : (uint8_t)FAULT_NONE;
+}
+
+// Forget everything about the zone, e.g. after the sensor or valve was fixed
+void FaultDetector::clear(uint8_t zone) {
+  if (zone > SCHEDULE_MAX_ZONES) return;
+  zones[zone] = ZoneHealth();
+}
+
+// The fault names stay in flash with the event catalog, and are also read by
+// tools/decode_events.py
+static const char FAULT_NONE_NAME[] PROGMEM = "none";
+static const char FAULT_FLATLINE_NAME[] PROGMEM = "sensor reading flatlined";
+static const char FAULT_NO_RESPONSE_NAME[] PROGMEM = "no response to irrigation";
+static const char FAULT_STEP_NAME[] PROGMEM = "sudden step in sensor reading";
+
+static const char * const FAULT_NAMES[] PROGMEM = {
+  FAULT_NONE_NAME,
+  FAULT_FLATLINE_NAME,
+  FAULT_NO_RESPONSE_NAME,
+  FAULT_STEP_NAME
+};
+
+// Name of a fault, in PROGMEM: read it with pgm_read_byte() or strcpy_P()
+const char *FaultDetector::name(uint8_t fault) {
+  return EVENT_READ_PTR(&FAULT_NAMES[fault <= FAULT_STEP ? fault : (uint8_t)FAULT_NONE]);
+}
+
+uint8_t FaultDetector::trip(ZoneHealth &health, uint8_t fault) {
+  health.fault = fault;
+  return fault;
+}
@@ -0,0 +1,65 @@
+#ifndef FAULT_DETECTOR_H
+#define FAULT_DETECTOR_H
+
+#include <stdint.h>
+#include <schedule.h>
+
+enum Fault {
+  FAULT_NONE,
+  FAULT_FLATLINE,    // sensor reading stopped moving
+  FAULT_NO_RESPONSE, // irrigation keeps not showing up in the reading
+  FAULT_STEP         // reading jumped and stayed there without irrigation
+};
+
+struct ZoneHealth {
+  float mean;          // exponentially weighted mean of the VWC
+  float variance;      // and its exponentially weighted variance
+  float last;
+  float baseline;      // VWC before the last irrigation
+  float stepFrom;      // mean before a suspected step
+  uint8_t samples;
+  uint16_t flatSamples;
+  uint8_t awaiting;    // samples left for the last irrigation to show up
+  uint8_t missed;      // irrigations in a row that didn't show up
+  bool stepPending;
+  uint8_t fault;
+};
+
+// Watches the VWC readings of every zone for faults the range check can't
+// catch: a sensor stuck at a plausible value, a valve that doesn't open
+// (or a dripper that is blocked) and a sensor that was knocked out of the
+// substrate. Each reading costs a handful of float operations and no
+// history is kept, so all 14 zones fit in a few hundred bytes.
+//
+// A zone with a fault is disabled until clear() is called, so the
+// controller can stop irrigating it instead of flooding or starving the bed.
+class FaultDetector {
+  public:
+    FaultDetector();
+
+    void setFlatline(float variance, uint16_t samples);
+    void setResponse(float minimumRise, uint8_t samples, uint8_t missedLimit);
+    void setStep(float threshold);
+
+    uint8_t update(uint8_t zone, float vwc);
+    void irrigated(uint8_t zone);
+
+    bool isDisabled(uint8_t zone) const;
+    uint8_t fault(uint8_t zone) const;
+    void clear(uint8_t zone);
+
+    static const char *name(uint8_t fault);
+
+  private:
+    ZoneHealth zones[SCHEDULE_MAX_ZONES + 1];
+    float flatVariance;
+    uint16_t flatLimit;
+    float minimumRise;
+    uint8_t responseSamples;
+    uint8_t missedLimit;
+    float stepThreshold;
+
+    uint8_t trip(ZoneHealth &zone, uint8_t fault);
+};
+
+#endif
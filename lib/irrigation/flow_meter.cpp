@@ -0,0 +1,124 @@
+#include <flow_meter.h>
+
+FlowMeter::FlowMeter() {
+  for (uint8_t meter = 0; meter < FLOW_MAX_METERS; meter++) {
+    overflow[meter] = 0;
+    overflowSeen[meter] = 0;
+    litersPerPulse[meter] = 1.0 / 450.0;
+    unattributed[meter] = 0;
+  }
+  for (uint8_t zone = 0; zone <= SCHEDULE_MAX_ZONES; zone++) {
+    zoneMeter[zone] = 0;
+    total[zone] = 0;
+    run[zone] = 0;
+    target[zone] = 0;
+  }
+}
+
+void FlowMeter::setPulsesPerLiter(uint8_t meter, float pulsesPerLiter) {
+  if (meter < FLOW_MAX_METERS && pulsesPerLiter > 0) litersPerPulse[meter] = 1.0 / pulsesPerLiter;
+}
+
+void FlowMeter::setZoneMeter(uint8_t zone, uint8_t meter) {
+  if (zone >= 1 && zone <= SCHEDULE_MAX_ZONES && meter < FLOW_MAX_METERS) zoneMeter[zone] = meter;
+}
+
+// A target of 0 leaves the zone on time based irrigation
+void FlowMeter::setTargetVolume(uint8_t zone, float liters) {
+  if (zone >= 1 && zone <= SCHEDULE_MAX_ZONES) target[zone] = liters;
+}
+
+// Interrupt side, keep it short
+void FlowMeter::pulse(uint8_t meter) {
+  if (!pulses.push(meter)) overflow[meter]++;
+}
+
+// Drain the pulses that came in since the last call and credit them to the
+// zones in openZones (bit n set for zone n). Returns the zones whose current
+// run has now delivered its target volume.
+uint16_t FlowMeter::update(uint16_t openZones) {
+  uint16_t counts[FLOW_MAX_METERS];
+  drain(counts);
+  return credit(counts, openZones);
+}
+
+// Collect the pulses of every meter that came in since the last call
+bool FlowMeter::drain(uint16_t counts[FLOW_MAX_METERS]) {
+  bool any = false;
+  uint8_t meter;
+  for (meter = 0; meter < FLOW_MAX_METERS; meter++) counts[meter] = 0;
+  while (pulses.pop(meter)) {
+    if (meter < FLOW_MAX_METERS) counts[meter]++;
+  }
+  for (meter = 0; meter < FLOW_MAX_METERS; meter++) {
+    uint8_t seen = overflow[meter];
+    counts[meter] += (uint8_t)(seen - overflowSeen[meter]);
+    overflowSeen[meter] = seen;
+    if (counts[meter] > 0) any = true;
+  }
+  return any;
+}
+
+// Credit pulse counts (as collected by drain()) to the zones in openZones
+uint16_t FlowMeter::credit(const uint16_t counts[FLOW_MAX_METERS], uint16_t openZones) {
+  for (uint8_t meter = 0; meter < FLOW_MAX_METERS; meter++) {
+    if (counts[meter] > 0) attribute(meter, counts[meter], openZones);
+  }
+
+  uint16_t reached = 0;
+  for (uint8_t zone = 1; zone <= SCHEDULE_MAX_ZONES; zone++) {
+    if ((openZones & (1 << zone)) && target[zone] > 0 && run[zone] >= target[zone]) reached |= (1 << zone);
+  }
+  return reached;
+}
+
+void FlowMeter::startRun(uint8_t zone) {
+  if (zone >= 1 && zone <= SCHEDULE_MAX_ZONES) run[zone] = 0;
+}
+
+float FlowMeter::liters(uint8_t zone) const {
+  return zone <= SCHEDULE_MAX_ZONES ? total[zone] : 0;
+}
+
+float FlowMeter::runLiters(uint8_t zone) const {
+  return zone <= SCHEDULE_MAX_ZONES ? run[zone] : 0;
+}
+
+float FlowMeter::targetVolume(uint8_t zone) const {
+  return zone <= SCHEDULE_MAX_ZONES ? target[zone] : 0;
+}
+
+uint8_t FlowMeter::meterOf(uint8_t zone) const {
+  return zone <= SCHEDULE_MAX_ZONES ? zoneMeter[zone] : 0;
+}
+
+// Liters that went through the meter while none of its zones were open,
+// since the last time this was called
+float FlowMeter::takeUnattributed(uint8_t meter) {
+  if (meter >= FLOW_MAX_METERS) return 0;
+  float liters = unattributed[meter];
+  unattributed[meter] = 0;
+  return liters;
+}
+
+// Several zones open on the same line share the water evenly
+void FlowMeter::attribute(uint8_t meter, uint16_t count, uint16_t openZones) {
+  uint8_t sharing = 0;
+  for (uint8_t zone = 1; zone <= SCHEDULE_MAX_ZONES; zone++) {
+    if ((openZones & (1 << zone)) && zoneMeter[zone] == meter) sharing++;
+  }
+
+  float liters = count * litersPerPulse[meter];
+  if (sharing == 0) {
+    unattributed[meter] += liters;
+    return;
+  }
+
+  liters /= sharing;
+  for (uint8_t zone = 1; zone <= SCHEDULE_MAX_ZONES; zone++) {
+    if ((openZones & (1 << zone)) && zoneMeter[zone] == meter) {
+      total[zone] += liters;
+      run[zone] += liters;
+    }
+  }
+}
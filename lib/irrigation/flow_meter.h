@@ -0,0 +1,60 @@
+#ifndef FLOW_METER_H
+#define FLOW_METER_H
+
+#include <stdint.h>
+#include <ring_buffer.h>
+#include <schedule.h>
+
+#define FLOW_MAX_METERS 2
+#define FLOW_BUFFER_SIZE 64
+
+// Counts the pulses of one or more pulse-output flow meters and turns them
+// into liters per zone.
+//
+// pulse() is called from the meter's pin interrupt and only queues the meter
+// number in a lock-free ring buffer. update() runs in the main loop, drains
+// the buffer and spreads the water over the zones that are open on that
+// meter's line at the time. Pulses that arrive while the buffer is full are
+// still counted through a per meter overflow counter, so they are late but
+// never lost as long as update() runs at least once every 256 overflows.
+//
+// Water that flows while none of a meter's zones are open can't be
+// attributed to anything. It is collected separately, as it usually means a
+// valve is stuck open or a line is leaking.
+class FlowMeter {
+  public:
+    FlowMeter();
+
+    void setPulsesPerLiter(uint8_t meter, float pulsesPerLiter);
+    void setZoneMeter(uint8_t zone, uint8_t meter);
+    void setTargetVolume(uint8_t zone, float liters);
+
+    void pulse(uint8_t meter);
+
+    uint16_t update(uint16_t openZones);
+    bool drain(uint16_t counts[FLOW_MAX_METERS]);
+    uint16_t credit(const uint16_t counts[FLOW_MAX_METERS], uint16_t openZones);
+    void startRun(uint8_t zone);
+
+    float liters(uint8_t zone) const;
+    float runLiters(uint8_t zone) const;
+    float targetVolume(uint8_t zone) const;
+    uint8_t meterOf(uint8_t zone) const;
+    float takeUnattributed(uint8_t meter);
+
+  private:
+    RingBuffer<uint8_t, FLOW_BUFFER_SIZE> pulses;
+    volatile uint8_t overflow[FLOW_MAX_METERS];
+    uint8_t overflowSeen[FLOW_MAX_METERS];
+
+    float litersPerPulse[FLOW_MAX_METERS];
+    float unattributed[FLOW_MAX_METERS];
+    uint8_t zoneMeter[SCHEDULE_MAX_ZONES + 1];
+    float total[SCHEDULE_MAX_ZONES + 1];
+    float run[SCHEDULE_MAX_ZONES + 1];
+    float target[SCHEDULE_MAX_ZONES + 1];
+
+    void attribute(uint8_t meter, uint16_t count, uint16_t openZones);
+};
+
+#endif
@@ -1,25 +1,189 @@
+#include <math.h>
 #include <irrigation.h>
 
 Irrigation::Irrigation() {
+  humidity = 0;
+  temperature = 0;
+  eSat = 0;
+  e = 0;
+  vpd = 0;
+  zoneCount = IRRIGATION_MAX_ZONES;
+  irrigTime = 30;
+  sampleTime = 1800;
+  subCalSlope = 1;
+  subCalIntercept = 0;
+  masterOpen = false;
+  settleUntil = 0;
+  for (uint8_t zone = 0; zone <= IRRIGATION_MAX_ZONES; zone++) {
+    thresholds[zone] = 0;
+    vwcs[zone] = 0;
+    counters[zone] = 0;
+    trippedFaults[zone] = FAULT_NONE;
+  }
+  faults.setStep(IRRIGATION_FAULT_STEP);
+  faults.setResponse(IRRIGATION_FAULT_RISE, 2, 3);
+  setRunTime(sampleTime);
+}
+
+// Start the schedule, the first set of readings is due right away
+void Irrigation::begin(uint32_t now) {
+  schedule.begin(now);
+}
+
+void Irrigation::setZones(uint8_t count) {
+  zoneCount = count <= IRRIGATION_MAX_ZONES ? count : IRRIGATION_MAX_ZONES;
+}
+
+void Irrigation::setThreshold(uint8_t zone, float vwc) {
+  if (zone >= 1 && zone <= IRRIGATION_MAX_ZONES) thresholds[zone] = vwc;
+}
+
+void Irrigation::setCalibration(float slope, float intercept) {
+  subCalSlope = slope;
+  subCalIntercept = intercept;
+}
+
+void Irrigation::setIrrigationTime(uint32_t seconds) {
+  irrigTime = seconds;
+  for (uint8_t zone = 1; zone <= IRRIGATION_MAX_ZONES; zone++) schedule.setDuration(zone, seconds);
+}
+
+// Also sets how many readings in a row make a flatline, so it still takes
+// IRRIGATION_FAULT_FLAT_SECONDS
+void Irrigation::setRunTime(uint32_t seconds) {
+  sampleTime = seconds;
+  schedule.setSampleInterval(seconds);
+  uint32_t samples = IRRIGATION_FAULT_FLAT_SECONDS / (seconds > 0 ? seconds : 1);
+  faults.setFlatline(IRRIGATION_FAULT_FLAT_VARIANCE, samples < 0xFFFF ? samples : 0xFFFF);
+}
+
+// Hand out the next valve or sample event that is due. Keeps the irrigation
+// counters, flow meter runs and fault detector in step with the valves
+bool Irrigation::poll(uint32_t now, ScheduleEvent &event) {
+  if (fast.zones()) holdFast(now);
+  // A zone disabled with a fault never opens, even if it was already queued
+  while (schedule.peek(now, event) && event.type == EVENT_ZONE_OPEN && faults.isDisabled(event.zone)) {
+    schedule.cancel(event.zone, now);
+  }
+  if (!schedule.poll(now, event)) return false;
 
+  switch (event.type) {
+    case EVENT_MASTER_OPEN:
+      masterOpen = true;
+      break;
+    case EVENT_ZONE_OPEN:
+      flow.startRun(event.zone);
+      break;
+    case EVENT_ZONE_CLOSE:
+      counters[event.zone]++;
+      faults.irrigated(event.zone);
+      settleUntil = now + IRRIGATION_FLOW_SETTLE_SECONDS;
+      break;
+    case EVENT_MASTER_CLOSE:
+      masterOpen = false;
+      break;
+  }
+  return true;
 }
 
-void Irrigation::begin() {
+// Work through a set of readings taken for an EVENT_SAMPLE: calculate the
+// VPD and VWC, check every zone for faults and ask for irrigation of the
+// zones that are below their threshold. A zone that trips a fault is taken
+// off the schedule. Fast zones are left to 'fast', and
+// held closed right away when they trip a fault
+void Irrigation::sample(const RawInputs &inputs) {
+  humidity = inputs.humidity;
+  temperature = inputs.temperature;
+
+  // Calculate saturation vapor pressure from the measured temperature
+  eSat = 0.6112*exp((17.67*temperature)/(temperature+243.5));
+  // Calculate vapor pressure from saturated vapor pressure
+  e = eSat*humidity/100;
+  // Calculate the vapor pressure deficit (VPD) from saturated and actual vapor pressure
+  vpd = eSat-e;
+
+  for (uint8_t zone = 1; zone <= zoneCount; zone++) {
+    // Convert the measured raw values to VWC using a calibration equation. Note the 2.56 is the reference voltage used for all analog measurements. Raw value of 0 = 0V, 1023 = 2.56V
+    // vwcs[zone] = inputs.sensorValue[zone] * (2.56/1023.0) * subCalSlope + subCalIntercept;
+    vwcs[zone] = inputs.sensorValue[zone] / 10;
+
+    trippedFaults[zone] = faults.update(zone, vwcs[zone]);
+    // Drop an irrigation it asked for earlier, e.g. one waiting out a blackout
+    if (trippedFaults[zone] != FAULT_NONE) schedule.cancel(zone, inputs.at);
+  }
+
+  for (uint8_t zone = 1; zone <= zoneCount; zone++) {
+    if (vwcs[zone] < thresholds[zone] && !faults.isDisabled(zone) && !fast.isFast(zone)) schedule.request(zone, inputs.at);
+  }
+  if (fast.zones()) holdFast(inputs.at);
+}
+
+// Fast zones follow the same rules as the schedule: they are held closed
+// through blackout windows and days, and while their plot is disabled. The
+// line drains down after a fast zone stops like after any other zone
+void Irrigation::holdFast(uint32_t now) {
+  bool blackedOut = schedule.isBlackedOut(now);
+  for (uint8_t zone = 1; zone <= IRRIGATION_MAX_ZONES; zone++) {
+    if (!fast.isFast(zone)) continue;
+    bool held = blackedOut || faults.isDisabled(zone);
+    if (held && !fast.isHeld(zone) && fast.isRunning()) settleUntil = now + IRRIGATION_FLOW_SETTLE_SECONDS;
+    fast.hold(zone, held);
+  }
+}
+
+// Credit flow meter pulses (as collected by FlowMeter::drain()) to the open
+// zone. Returns true when that zone has received its target volume and its
+// close has been brought forward to 'now'. With no zone open the pulses only
+// count as a leak once the line has settled (see IRRIGATION_FLOW_SETTLE_SECONDS).
+// The pulses of a meter with a fast zone cycling on it can't be told apart, so
+// they are left out altogether: no leak, and no flow cutoff for the open zone
+bool Irrigation::meter(uint32_t now, const uint16_t pulses[FLOW_MAX_METERS]) {
+  uint8_t zone = schedule.openZone();
+  if (!zone && (masterOpen || now < settleUntil)) return false;
+  uint16_t counts[FLOW_MAX_METERS];
+  for (uint8_t meter = 0; meter < FLOW_MAX_METERS; meter++) counts[meter] = pulses[meter];
+  if (fast.isRunning()) {
+    for (uint8_t fastZone = 1; fastZone <= IRRIGATION_MAX_ZONES; fastZone++) {
+      if (fast.isFast(fastZone) && !fast.isHeld(fastZone)) counts[flow.meterOf(fastZone)] = 0;
+    }
+  }
+  uint16_t reached = flow.credit(counts, zone ? (1 << zone) : 0);
+  return zone && (reached & (1 << zone)) && schedule.closeEarly(zone, now);
+}
+
+uint8_t Irrigation::zones() const {
+  return zoneCount;
+}
+
+uint32_t Irrigation::irrigationTime() const {
+  return irrigTime;
+}
+
+uint32_t Irrigation::runTime() const {
+  return sampleTime;
+}
+
+float Irrigation::calibrationSlope() const {
+  return subCalSlope;
+}
 
+float Irrigation::calibrationIntercept() const {
+  return subCalIntercept;
 }
 
-int Irrigation::add(int a, int b) {
-    return a + b;
+float Irrigation::threshold(uint8_t zone) const {
+  return zone <= IRRIGATION_MAX_ZONES ? thresholds[zone] : 0;
 }
 
-int Irrigation::sub(int a, int b) {
-    return a - b;
+float Irrigation::vwc(uint8_t zone) const {
+  return zone <= IRRIGATION_MAX_ZONES ? vwcs[zone] : 0;
 }
 
-int Irrigation::mul(int a, int b) {
-    return a * b;
+int Irrigation::counter(uint8_t zone) const {
+  return zone <= IRRIGATION_MAX_ZONES ? counters[zone] : 0;
 }
 
-int Irrigation::div(int a, int b) {
-    return a / b;
+// Fault the zone tripped on the last set of readings, FAULT_NONE if nothing new
+uint8_t Irrigation::tripped(uint8_t zone) const {
+  return zone <= IRRIGATION_MAX_ZONES ? trippedFaults[zone] : (uint8_t)FAULT_NONE;
 }
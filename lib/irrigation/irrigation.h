@@ -1,15 +1,93 @@
 #ifndef IRRIGATION_H
 #define IRRIGATION_H
 
+#include <stdint.h>
+#include <schedule.h>
+#include <flow_meter.h>
+#include <fault_detector.h>
+#include <fast_control.h>
+
+#define IRRIGATION_MAX_ZONES SCHEDULE_MAX_ZONES
+// Flow while no zone is open isn't a leak while the master valve is open
+// (the line filling during the master delay) or for this many seconds after
+// a zone closed (the line draining down)
+#define IRRIGATION_FLOW_SETTLE_SECONDS 10
+
+// sample() works out VWC as sensorValue / 10, whole numbers from 0 - 102
+// rather than m3/m3, so the fault detector is set up for that scale: a jump
+// of more than IRRIGATION_FAULT_STEP is a step, an irrigation has to add at
+// least IRRIGATION_FAULT_RISE, and a reading that hasn't moved for
+// IRRIGATION_FAULT_FLAT_SECONDS is a stuck sensor. A whole number reading
+// can easily sit still for a day, so that is a lot longer than a day
+#define IRRIGATION_FAULT_STEP 15
+#define IRRIGATION_FAULT_RISE 2
+#define IRRIGATION_FAULT_FLAT_VARIANCE 0.01
+#define IRRIGATION_FAULT_FLAT_SECONDS (3 * SCHEDULE_SECONDS_PER_DAY)
+
+// Everything the control code reads from the hardware for one set of
+// readings. This is what a trace records and what a replay feeds back in
+struct RawInputs {
+  uint32_t at;                                   // RTC seconds since 2000-01-01
+  int16_t sensorValue[IRRIGATION_MAX_ZONES + 1]; // analogRead() of each 10HS sensor
+  float humidity;                                // as returned by the DHT, may be NaN
+  float temperature;
+};
+
+// The decisions the controller makes, without any of the hardware access.
+// The sketch reads the sensors and drives the relays, this class only turns
+// readings, flow meter pulses and the time into valve events, so the same
+// code can be run on recorded or simulated inputs in the native env.
 class Irrigation {
   public:
     Irrigation();
-    void begin();
-    int x;
-    int add (int a, int b);
-    int sub (int a, int b);
-    int mul (int a, int b);
-    int div (int a, int b);
+    void begin(uint32_t now);
+
+    void setZones(uint8_t count);
+    void setThreshold(uint8_t zone, float vwc);
+    void setCalibration(float slope, float intercept);
+    void setIrrigationTime(uint32_t seconds);
+    void setRunTime(uint32_t seconds);
+
+    bool poll(uint32_t now, ScheduleEvent &event);
+    void sample(const RawInputs &inputs);
+    bool meter(uint32_t now, const uint16_t pulses[FLOW_MAX_METERS]);
+
+    uint8_t zones() const;
+    uint32_t irrigationTime() const;
+    uint32_t runTime() const;
+    float calibrationSlope() const;
+    float calibrationIntercept() const;
+    float threshold(uint8_t zone) const;
+    float vwc(uint8_t zone) const;
+    int counter(uint8_t zone) const;
+    uint8_t tripped(uint8_t zone) const;
+
+    // Environmental conditions from the last set of readings
+    float humidity;
+    float temperature;
+    float eSat;
+    float e;
+    float vpd;
+
+    Schedule schedule;
+    FlowMeter flow;
+    FaultDetector faults;
+    FastControl fast;
+
+  private:
+    void holdFast(uint32_t now);
+
+    uint8_t zoneCount;
+    uint32_t irrigTime;
+    uint32_t sampleTime;
+    float thresholds[IRRIGATION_MAX_ZONES + 1];
+    float subCalSlope;
+    float subCalIntercept;
+    float vwcs[IRRIGATION_MAX_ZONES + 1];
+    int counters[IRRIGATION_MAX_ZONES + 1];
+    uint8_t trippedFaults[IRRIGATION_MAX_ZONES + 1];
+    bool masterOpen;
+    uint32_t settleUntil;
 };
 
 #endif
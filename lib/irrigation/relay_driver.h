@@ -0,0 +1,126 @@
+#ifndef RELAY_DRIVER_H
+#define RELAY_DRIVER_H
+
+#include <stdint.h>
+
+// The relays are on pins 22 - 36: 22 - 29 are PA0 - PA7 and 30 - 36 are
+// PC7 - PC1 on the Mega (37 is PC0 and isn't a relay). Bit n of the mask is
+// the relay on pin n + 21, so bits 1 - 14 are the plots and bit 15 the master
+#define RELAY_FIRST_PIN 22
+#define RELAY_LAST_PIN 36
+#define RELAY_MASK_BIT(pin) ((pin) - 21)
+#define RELAY_PORT_A 0
+#define RELAY_PORT_C 1
+#define RELAY_PORT_A_BITS 0xFF
+#define RELAY_PORT_C_BITS 0xFE
+
+// Keeps the state of every relay in a shadow copy of PORTA and PORTC and
+// switches them with one store per port, so any number of valves change in
+// the same instant instead of one digitalWrite() (table lookups and an
+// interrupt-off section each) after the other. set() only changes the shadow,
+// apply() writes it out. The relays use reverse logic: LOW opens.
+//
+// The registers are reached through a policy, so the Mega writes PORTA and
+// PORTC directly and the native tests can check what would be written:
+//
+//   uint8_t read(uint8_t port)                 RELAY_PORT_A or RELAY_PORT_C
+//   void write(uint8_t port, uint8_t value)
+//   void output(uint8_t port, uint8_t bits)    make 'bits' outputs (DDRx |= bits)
+//
+// Pin 37 (PC0) keeps whatever it was set to elsewhere.
+template <class Ports>
+class RelayDriver {
+  public:
+    RelayDriver() : openA(0), openC(0) {}
+
+    // Close every relay, then make all relay pins outputs
+    void begin() {
+      openA = 0;
+      openC = 0;
+      apply();
+      ports.output(RELAY_PORT_A, RELAY_PORT_A_BITS);
+      ports.output(RELAY_PORT_C, RELAY_PORT_C_BITS);
+    }
+
+    static bool isRelay(uint8_t pin) {
+      return pin >= RELAY_FIRST_PIN && pin <= RELAY_LAST_PIN;
+    }
+
+    static uint8_t portOf(uint8_t pin) {
+      return pin <= 29 ? RELAY_PORT_A : RELAY_PORT_C;
+    }
+
+    static uint8_t bitOf(uint8_t pin) {
+      return pin <= 29 ? 1 << (pin - 22) : 1 << (37 - pin);
+    }
+
+    // Make the relay on 'pin' an output. Apply it closed first, or it
+    // starts out open
+    void output(uint8_t pin) {
+      if (isRelay(pin)) ports.output(portOf(pin), bitOf(pin));
+    }
+
+    // Stage opening or closing the relay on 'pin'
+    void set(uint8_t pin, bool open) {
+      if (!isRelay(pin)) return;
+      uint8_t &shadow = portOf(pin) == RELAY_PORT_A ? openA : openC;
+      if (open) shadow |= bitOf(pin);
+      else shadow &= ~bitOf(pin);
+    }
+
+    // Stage the relays for a whole mask at once (see RELAY_MASK_BIT)
+    void setMask(uint16_t mask) {
+      openA = mask >> 1;
+      openC = portC(mask);
+    }
+
+    // Stage only the relays set in 'which', to their state in 'open'
+    void setMasked(uint16_t which, uint16_t open) {
+      setMask((mask() & ~which) | (open & which));
+    }
+
+    // Write the staged relays to the ports, one store each
+    void apply() {
+      applyPorts(RELAY_PORT_A_BITS, RELAY_PORT_C_BITS);
+    }
+
+    // Write only the relays set in 'which', e.g. from an interrupt while the
+    // main loop has other changes staged. Ports without any are left alone
+    void apply(uint16_t which) {
+      applyPorts(which >> 1, portC(which));
+    }
+
+    // Staged state: bit RELAY_MASK_BIT(pin) is set when that relay is open
+    uint16_t mask() const {
+      uint16_t mask = (uint16_t)openA << 1;
+      for (uint8_t pin = 30; pin <= RELAY_LAST_PIN; pin++) {
+        if (openC & bitOf(pin)) mask |= 1 << RELAY_MASK_BIT(pin);
+      }
+      return mask;
+    }
+
+    bool isOpen(uint8_t pin) const {
+      return isRelay(pin) && (mask() & (1 << RELAY_MASK_BIT(pin)));
+    }
+
+    Ports ports;
+
+  private:
+    static uint8_t portC(uint16_t mask) {
+      uint8_t bits = 0;
+      for (uint8_t pin = 30; pin <= RELAY_LAST_PIN; pin++) {
+        if (mask & (1 << RELAY_MASK_BIT(pin))) bits |= bitOf(pin);
+      }
+      return bits;
+    }
+
+    void applyPorts(uint8_t bitsA, uint8_t bitsC) {
+      if (bitsA) ports.write(RELAY_PORT_A, (ports.read(RELAY_PORT_A) & ~bitsA) | (~openA & bitsA));
+      if (bitsC) ports.write(RELAY_PORT_C, (ports.read(RELAY_PORT_C) & ~bitsC) | (~openC & bitsC));
+    }
+
+    uint8_t openA;  // shadow of the relay bits, set = open
+    uint8_t openC;
+};
+
+#endif
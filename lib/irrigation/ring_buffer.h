@@ -0,0 +1,56 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stdint.h>
+
+// Keeps the compiler from moving the slot write past the index update (and
+// the slot read past the index check). A single core AVR needs nothing more
+#define RING_BUFFER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+// Single-producer/single-consumer queue that needs no locks or interrupt
+// masking: only the producer (usually an ISR) writes head and only the
+// consumer (the main loop) writes tail. Both indices are one byte so they are
+// read and written atomically on AVR. SIZE must be a power of two no larger
+// than 128, one slot is kept free to tell a full buffer from an empty one.
+template <class T, uint8_t SIZE>
+class RingBuffer {
+  static_assert(SIZE >= 2 && SIZE <= 128 && (SIZE & (SIZE - 1)) == 0, "RingBuffer SIZE must be a power of two up to 128");
+
+  public:
+    RingBuffer() : head(0), tail(0) {}
+
+    bool push(const T &value) {
+      uint8_t h = head;
+      uint8_t next = (h + 1) & (SIZE - 1);
+      if (next == tail) return false;
+      items[h] = value;
+      RING_BUFFER_BARRIER();
+      head = next;
+      return true;
+    }
+
+    bool pop(T &value) {
+      uint8_t t = tail;
+      if (t == head) return false;
+      RING_BUFFER_BARRIER();
+      value = items[t];
+      RING_BUFFER_BARRIER();
+      tail = (t + 1) & (SIZE - 1);
+      return true;
+    }
+
+    bool isEmpty() const {
+      return head == tail;
+    }
+
+    uint8_t count() const {
+      return (head - tail) & (SIZE - 1);
+    }
+
+  private:
+    T items[SIZE];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+};
+
+#endif
@@ -0,0 +1,295 @@
+#include <schedule.h>
+
+Schedule::Schedule() {
+  sampleInterval = 1800;
+  masterDelay = 0;
+  blackoutDays = 0;
+  windowCount = 0;
+  for (uint8_t zone = 0; zone <= SCHEDULE_MAX_ZONES; zone++) {
+    duration[zone] = 30;
+    priority[zone] = 0;
+  }
+  queueCount = 0;
+  pending = 0;
+  requestedAt = 0;
+  runningZone = 0;
+  currentZone = 0;
+  masterOn = false;
+}
+
+void Schedule::setSampleInterval(uint32_t seconds) {
+  sampleInterval = seconds > 0 ? seconds : 1;
+}
+
+void Schedule::setDuration(uint8_t zone, uint32_t seconds) {
+  if (zone >= 1 && zone <= SCHEDULE_MAX_ZONES) duration[zone] = seconds;
+}
+
+void Schedule::setPriority(uint8_t zone, uint8_t level) {
+  if (zone >= 1 && zone <= SCHEDULE_MAX_ZONES) priority[zone] = level;
+}
+
+void Schedule::setMasterDelay(uint32_t seconds) {
+  masterDelay = seconds;
+}
+
+void Schedule::setBlackoutDays(uint8_t dayMask) {
+  blackoutDays = dayMask & SCHEDULE_ALL_DAYS;
+}
+
+bool Schedule::addBlackoutWindow(uint16_t startMinute, uint16_t endMinute, uint8_t dayMask) {
+  if (windowCount >= SCHEDULE_MAX_WINDOWS) return false;
+  if (startMinute >= 1440 || endMinute > 1440 || startMinute == endMinute) return false;
+  windows[windowCount].startMinute = startMinute;
+  windows[windowCount].endMinute = endMinute;
+  windows[windowCount].dayMask = dayMask & SCHEDULE_ALL_DAYS;
+  windowCount++;
+  return true;
+}
+
+void Schedule::clearBlackoutWindows() {
+  windowCount = 0;
+}
+
+// Drop everything that was queued and take the first sample right away
+void Schedule::begin(uint32_t now) {
+  queueCount = 0;
+  pending = 0;
+  requestedAt = 0;
+  runningZone = 0;
+  currentZone = 0;
+  masterOn = false;
+  push(now, EVENT_SAMPLE, 0);
+}
+
+// Ask for one irrigation of the zone. It is started by the next poll(), so
+// zones requested together go by priority. Returns false if the zone is
+// unknown, already waiting or currently running
+bool Schedule::request(uint8_t zone, uint32_t now) {
+  if (zone < 1 || zone > SCHEDULE_MAX_ZONES) return false;
+  if (zone == runningZone || isPending(zone)) return false;
+  if (blackoutDays == SCHEDULE_ALL_DAYS) return false;
+
+  if (runningZone == 0 && pending == 0) requestedAt = now;
+  pending |= (1 << zone);
+  return true;
+}
+
+// Bring the close of the open zone forward to 'now', e.g. because it has
+// already received its target volume. The next pending zone then starts as
+// soon as the close is handed out
+bool Schedule::closeEarly(uint8_t zone, uint32_t now) {
+  if (zone == 0 || zone != currentZone) return false;
+  for (uint8_t index = 0; index < queueCount; index++) {
+    if (queue[index].type == EVENT_ZONE_CLOSE && queue[index].zone == zone) {
+      if (queue[index].at <= now) return false;
+      queue[index].at = now;
+      siftUp(index);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Take the zone off the schedule, e.g. because it has been disabled with a
+// fault. A pending or queued irrigation is dropped along with the master open
+// queued for it, an open zone is closed at 'now'
+void Schedule::cancel(uint8_t zone, uint32_t now) {
+  if (zone < 1 || zone > SCHEDULE_MAX_ZONES) return;
+  pending &= ~(1 << zone);
+  if (zone != runningZone) return;
+  if (zone == currentZone) {
+    closeEarly(zone, now);
+    return;
+  }
+
+  drop(EVENT_ZONE_OPEN, zone);
+  drop(EVENT_ZONE_CLOSE, zone);
+  if (drop(EVENT_MASTER_OPEN, 0)) masterOn = false;
+  runningZone = 0;
+  startNext(now);
+}
+
+// The event poll() would hand out at 'now', without handing it out
+bool Schedule::peek(uint32_t now, ScheduleEvent &event) {
+  if (runningZone == 0 && pending) startNext(requestedAt);
+  if (queueCount == 0 || queue[0].at > now) return false;
+  event = queue[0];
+  return true;
+}
+
+// Hand out the next event that is due at 'now', keeping the queue topped up
+// with whatever has to happen after it
+bool Schedule::poll(uint32_t now, ScheduleEvent &event) {
+  if (!peek(now, event)) return false;
+  pop();
+
+  switch (event.type) {
+    case EVENT_SAMPLE: {
+      // If the controller was held up for several intervals, skip the missed
+      // samples rather than firing them back to back
+      uint32_t next = event.at + sampleInterval;
+      if (next <= now) next += ((now - next) / sampleInterval + 1) * sampleInterval;
+      push(next, EVENT_SAMPLE, 0);
+      break;
+    }
+    case EVENT_ZONE_OPEN:
+      currentZone = event.zone;
+      break;
+    case EVENT_ZONE_CLOSE:
+      currentZone = 0;
+      runningZone = 0;
+      startNext(event.at);
+      break;
+  }
+  return true;
+}
+
+uint32_t Schedule::nextDue() const {
+  if (runningZone == 0 && pending) return requestedAt;
+  return queueCount > 0 ? queue[0].at : SCHEDULE_NEVER;
+}
+
+uint8_t Schedule::openZone() const {
+  return currentZone;
+}
+
+bool Schedule::isPending(uint8_t zone) const {
+  return (pending & (1 << zone)) != 0;
+}
+
+bool Schedule::isBlackedOut(uint32_t at) const {
+  return blockedUntil(at, at + 1) != 0;
+}
+
+// Earliest time at or after 'at' where a run of 'length' seconds does not
+// touch any blackout day or window
+uint32_t Schedule::nextAllowed(uint32_t at, uint32_t length) const {
+  if (length == 0) length = 1;
+  uint32_t t = at;
+  for (uint8_t guard = 0; guard < 64; guard++) {
+    uint32_t blocked = blockedUntil(t, t + length);
+    if (blocked == 0) return t;
+    t = blocked;
+  }
+  return t;
+}
+
+// 2000-01-01 was a Saturday
+uint8_t Schedule::dayOfTheWeek(uint32_t at) {
+  return (at / SCHEDULE_SECONDS_PER_DAY + 6) % 7;
+}
+
+// Start the highest priority pending zone, or shut the master valve down when
+// nothing is left to do
+void Schedule::startNext(uint32_t now) {
+  uint8_t zone = 0;
+  for (uint8_t z = 1; z <= SCHEDULE_MAX_ZONES; z++) {
+    if (isPending(z) && (zone == 0 || priority[z] > priority[zone])) zone = z;
+  }
+
+  if (zone == 0) {
+    if (masterOn) {
+      push(now, EVENT_MASTER_CLOSE, 0);
+      masterOn = false;
+    }
+    return;
+  }
+
+  // Don't keep the pump running while we wait out a blackout
+  if (masterOn && nextAllowed(now, duration[zone]) != now) {
+    push(now, EVENT_MASTER_CLOSE, 0);
+    masterOn = false;
+  }
+
+  uint32_t lead = masterOn ? 0 : masterDelay;
+  uint32_t start = nextAllowed(now, lead + duration[zone]);
+
+  pending &= ~(1 << zone);
+  runningZone = zone;
+  if (!masterOn) {
+    push(start, EVENT_MASTER_OPEN, 0);
+    masterOn = true;
+  }
+  push(start + lead, EVENT_ZONE_OPEN, zone);
+  push(start + lead + duration[zone], EVENT_ZONE_CLOSE, zone);
+}
+
+// Returns the end of the first blackout overlapping [from, to), or 0 if the
+// whole span is allowed
+uint32_t Schedule::blockedUntil(uint32_t from, uint32_t to) const {
+  for (uint32_t day = from / SCHEDULE_SECONDS_PER_DAY; day * SCHEDULE_SECONDS_PER_DAY < to; day++) {
+    uint32_t midnight = day * SCHEDULE_SECONDS_PER_DAY;
+    uint8_t bit = DAY_BIT(dayOfTheWeek(midnight));
+
+    if (blackoutDays & bit) return midnight + SCHEDULE_SECONDS_PER_DAY;
+
+    for (uint8_t w = 0; w < windowCount; w++) {
+      if (!(windows[w].dayMask & bit)) continue;
+      uint32_t start = midnight + windows[w].startMinute * 60UL;
+      uint32_t end = midnight + windows[w].endMinute * 60UL;
+      if (windows[w].startMinute < windows[w].endMinute) {
+        if (from < end && start < to) return end;
+      }
+      else {
+        // Window wraps past midnight, so on any given day it covers the
+        // morning up to 'end' and the evening from 'start'
+        if (from < end && midnight < to) return end;
+        if (from < midnight + SCHEDULE_SECONDS_PER_DAY && start < to) return midnight + SCHEDULE_SECONDS_PER_DAY;
+      }
+    }
+  }
+  return 0;
+}
+
+bool Schedule::before(const ScheduleEvent &a, const ScheduleEvent &b) {
+  if (a.at != b.at) return a.at < b.at;
+  return a.type < b.type;
+}
+
+// The queue is a binary min-heap on (at, type)
+bool Schedule::push(uint32_t at, uint8_t type, uint8_t zone) {
+  if (queueCount >= SCHEDULE_QUEUE_SIZE) return false;
+
+  ScheduleEvent event = { at, type, zone };
+  queue[queueCount] = event;
+  siftUp(queueCount++);
+  return true;
+}
+
+// Take the first queued event of that type and zone out of the queue
+bool Schedule::drop(uint8_t type, uint8_t zone) {
+  for (uint8_t index = 0; index < queueCount; index++) {
+    if (queue[index].type != type || queue[index].zone != zone) continue;
+    queue[index] = queue[--queueCount];
+    // Restore the heap, the queue is short enough to just sift every entry
+    for (uint8_t child = 1; child < queueCount; child++) siftUp(child);
+    return true;
+  }
+  return false;
+}
+
+void Schedule::siftUp(uint8_t child) {
+  ScheduleEvent event = queue[child];
+  while (child > 0) {
+    uint8_t parent = (child - 1) / 2;
+    if (!before(event, queue[parent])) break;
+    queue[child] = queue[parent];
+    child = parent;
+  }
+  queue[child] = event;
+}
+
+void Schedule::pop() {
+  ScheduleEvent last = queue[--queueCount];
+  uint8_t parent = 0;
+  while (true) {
+    uint8_t child = 2 * parent + 1;
+    if (child >= queueCount) break;
+    if (child + 1 < queueCount && before(queue[child + 1], queue[child])) child++;
+    if (!before(queue[child], last)) break;
+    queue[parent] = queue[child];
+    parent = child;
+  }
+  if (queueCount > 0) queue[parent] = last;
+}
@@ -0,0 +1,105 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdint.h>
+
+// Zones are numbered from 1 like the plots in the sketch, so arrays are sized
+// SCHEDULE_MAX_ZONES + 1 and slot 0 is unused
+#define SCHEDULE_MAX_ZONES 14
+#define SCHEDULE_MAX_WINDOWS 4
+#define SCHEDULE_QUEUE_SIZE 8
+
+#define SCHEDULE_SECONDS_PER_DAY 86400UL
+#define SCHEDULE_NEVER 0xFFFFFFFFUL
+#define SCHEDULE_ALL_DAYS 0x7F
+
+// Day mask bits follow DateTime::dayOfTheWeek(), bit 0 is Sunday
+#define DAY_BIT(dayOfTheWeek) (1 << (dayOfTheWeek))
+
+// Events that share a timestamp are handed out in this order, so a zone is
+// always closed before the next one (or a sample) is started
+enum ScheduleEventType {
+  EVENT_ZONE_CLOSE,
+  EVENT_MASTER_CLOSE,
+  EVENT_SAMPLE,
+  EVENT_MASTER_OPEN,
+  EVENT_ZONE_OPEN
+};
+
+struct ScheduleEvent {
+  uint32_t at;    // RTC time in seconds since 2000-01-01 (DateTime::secondstime())
+  uint8_t type;   // ScheduleEventType
+  uint8_t zone;   // 1 - SCHEDULE_MAX_ZONES, 0 for sample and master valve events
+};
+
+struct BlackoutWindow {
+  uint16_t startMinute; // minutes after midnight, windows may wrap past midnight
+  uint16_t endMinute;
+  uint8_t dayMask;
+};
+
+// Compiles the watering rules into a queue of upcoming events ordered by RTC
+// time. The caller only ever looks at the head of the queue (nextDue()), so
+// the controller can idle until something is actually due instead of checking
+// every rule on every pass through loop().
+//
+// Zones are irrigated one at a time. Zones asking for water wait in a pending
+// set and are started highest priority first. Nothing starts before the next
+// poll(), so all the zones requested on one set of readings compete.
+// The master valve/pump is opened masterDelay seconds ahead of the first zone
+// and closed when the last pending zone is done.
+class Schedule {
+  public:
+    Schedule();
+
+    void setSampleInterval(uint32_t seconds);
+    void setDuration(uint8_t zone, uint32_t seconds);
+    void setPriority(uint8_t zone, uint8_t priority);
+    void setMasterDelay(uint32_t seconds);
+    void setBlackoutDays(uint8_t dayMask);
+    bool addBlackoutWindow(uint16_t startMinute, uint16_t endMinute, uint8_t dayMask = SCHEDULE_ALL_DAYS);
+    void clearBlackoutWindows();
+
+    void begin(uint32_t now);
+    bool request(uint8_t zone, uint32_t now);
+    bool closeEarly(uint8_t zone, uint32_t now);
+    void cancel(uint8_t zone, uint32_t now);
+    bool peek(uint32_t now, ScheduleEvent &event);
+    bool poll(uint32_t now, ScheduleEvent &event);
+    uint32_t nextDue() const;
+
+    uint8_t openZone() const;
+    bool isPending(uint8_t zone) const;
+    bool isBlackedOut(uint32_t at) const;
+    uint32_t nextAllowed(uint32_t at, uint32_t duration) const;
+
+    static uint8_t dayOfTheWeek(uint32_t at);
+
+  private:
+    uint32_t sampleInterval;
+    uint32_t masterDelay;
+    uint32_t duration[SCHEDULE_MAX_ZONES + 1];
+    uint8_t priority[SCHEDULE_MAX_ZONES + 1];
+    uint8_t blackoutDays;
+    BlackoutWindow windows[SCHEDULE_MAX_WINDOWS];
+    uint8_t windowCount;
+
+    ScheduleEvent queue[SCHEDULE_QUEUE_SIZE];
+    uint8_t queueCount;
+
+    uint16_t pending;
+    uint32_t requestedAt; // when the pending zones asked, if none is running
+    uint8_t runningZone;
+    uint8_t currentZone;
+    bool masterOn;
+
+    void startNext(uint32_t now);
+    uint32_t blockedUntil(uint32_t from, uint32_t to) const;
+    bool push(uint32_t at, uint8_t type, uint8_t zone);
+    bool drop(uint8_t type, uint8_t zone);
+    void pop();
+    void siftUp(uint8_t child);
+    static bool before(const ScheduleEvent &a, const ScheduleEvent &b);
+};
+
+#endif
@@ -0,0 +1,241 @@
+#include <string.h>
+#include <trace.h>
+
+static uint8_t put16(uint8_t *out, uint16_t value) {
+  out[0] = value;
+  out[1] = value >> 8;
+  return 2;
+}
+
+static uint8_t put32(uint8_t *out, uint32_t value) {
+  put16(out, value);
+  put16(out + 2, value >> 16);
+  return 4;
+}
+
+static uint8_t putFloat(uint8_t *out, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, 4);
+  return put32(out, bits);
+}
+
+static uint16_t get16(const uint8_t *in) {
+  return in[0] | (uint16_t)in[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *in) {
+  return get16(in) | (uint32_t)get16(in + 2) << 16;
+}
+
+static float getFloat(const uint8_t *in) {
+  uint32_t bits = get32(in);
+  float value;
+  memcpy(&value, &bits, 4);
+  return value;
+}
+
+// The encoders fill 'record' (at least TRACE_MAX_RECORD bytes) and return
+// the length of the record
+
+uint8_t traceBegin(uint8_t *record, uint32_t now, const Irrigation &irrigation) {
+  uint8_t length = 0;
+  record[length++] = TRACE_BEGIN;
+  length += put32(record + length, now);
+  record[length++] = irrigation.zones();
+  length += put32(record + length, irrigation.runTime());
+  length += put32(record + length, irrigation.irrigationTime());
+  length += putFloat(record + length, irrigation.calibrationSlope());
+  length += putFloat(record + length, irrigation.calibrationIntercept());
+  for (uint8_t zone = 1; zone <= irrigation.zones(); zone++) {
+    length += putFloat(record + length, irrigation.threshold(zone));
+  }
+  return length;
+}
+
+uint8_t tracePass(uint8_t *record, uint32_t now) {
+  record[0] = TRACE_PASS;
+  return 1 + put32(record + 1, now);
+}
+
+uint8_t traceInputs(uint8_t *record, const RawInputs &inputs, uint8_t zones) {
+  uint8_t length = 0;
+  record[length++] = TRACE_INPUTS;
+  length += put32(record + length, inputs.at);
+  record[length++] = zones;
+  for (uint8_t zone = 1; zone <= zones; zone++) {
+    length += put16(record + length, inputs.sensorValue[zone]);
+  }
+  length += putFloat(record + length, inputs.humidity);
+  length += putFloat(record + length, inputs.temperature);
+  return length;
+}
+
+uint8_t traceFlow(uint8_t *record, uint32_t now, const uint16_t pulses[FLOW_MAX_METERS]) {
+  uint8_t length = 0;
+  record[length++] = TRACE_FLOW;
+  length += put32(record + length, now);
+  for (uint8_t meter = 0; meter < FLOW_MAX_METERS; meter++) {
+    length += put16(record + length, pulses[meter]);
+  }
+  return length;
+}
+
+uint8_t traceDecision(uint8_t *record, const ScheduleEvent &event) {
+  record[0] = TRACE_DECISION;
+  put32(record + 1, event.at);
+  record[5] = event.type;
+  record[6] = event.zone;
+  return 7;
+}
+
+// Decode the record at the start of 'trace'. Returns its length, or 0 when
+// the record is unknown or cut short (e.g. by a power cut while writing)
+uint8_t readTraceRecord(const uint8_t *trace, uint32_t length, TraceRecord &record) {
+  if (length < 5) return 0;
+  record.type = trace[0];
+  record.at = get32(trace + 1);
+  uint32_t used = 5;
+
+  switch (record.type) {
+    case TRACE_BEGIN: {
+      if (length < used + 17) return 0;
+      TraceSetup &setup = record.setup;
+      setup.zones = trace[used++];
+      if (setup.zones > IRRIGATION_MAX_ZONES || length < used + 16 + 4 * setup.zones) return 0;
+      setup.runTime = get32(trace + used);
+      setup.irrigationTime = get32(trace + used + 4);
+      setup.slope = getFloat(trace + used + 8);
+      setup.intercept = getFloat(trace + used + 12);
+      used += 16;
+      for (uint8_t zone = 1; zone <= setup.zones; zone++, used += 4) {
+        setup.thresholds[zone] = getFloat(trace + used);
+      }
+      return used;
+    }
+    case TRACE_PASS:
+      return used;
+    case TRACE_INPUTS: {
+      if (length < used + 1) return 0;
+      uint8_t zones = trace[used++];
+      if (zones > IRRIGATION_MAX_ZONES || length < used + 2 * zones + 8) return 0;
+      record.inputs.at = record.at;
+      for (uint8_t zone = 0; zone <= IRRIGATION_MAX_ZONES; zone++) {
+        record.inputs.sensorValue[zone] = 0;
+      }
+      for (uint8_t zone = 1; zone <= zones; zone++, used += 2) {
+        record.inputs.sensorValue[zone] = get16(trace + used);
+      }
+      record.inputs.humidity = getFloat(trace + used);
+      record.inputs.temperature = getFloat(trace + used + 4);
+      return used + 8;
+    }
+    case TRACE_FLOW:
+      if (length < used + 2 * FLOW_MAX_METERS) return 0;
+      for (uint8_t meter = 0; meter < FLOW_MAX_METERS; meter++, used += 2) {
+        record.pulses[meter] = get16(trace + used);
+      }
+      return used;
+    case TRACE_DECISION:
+      if (length < used + 2) return 0;
+      record.event.at = record.at;
+      record.event.type = trace[used];
+      record.event.zone = trace[used + 1];
+      return used + 2;
+  }
+  return 0;
+}
+
+void applyTraceSetup(const TraceSetup &setup, Irrigation &irrigation) {
+  irrigation.setZones(setup.zones);
+  irrigation.setRunTime(setup.runTime);
+  irrigation.setIrrigationTime(setup.irrigationTime);
+  irrigation.setCalibration(setup.slope, setup.intercept);
+  for (uint8_t zone = 1; zone <= setup.zones; zone++) {
+    irrigation.setThreshold(zone, setup.thresholds[zone]);
+  }
+}
+
+// Feed a recorded trace through the control code and check that it makes
+// exactly the recorded valve decisions. Settings that aren't part of the
+// TRACE_BEGIN record (watering windows, priorities, flow targets, ...) have
+// to be set on 'irrigation' the same way as on the device beforehand.
+//
+// Every TRACE_BEGIN (the device booting, a trace can span several) starts
+// over from those settings, with no counters, fault history or flow totals
+// left over. Returns true if the whole trace replayed without a mismatch.
+// A trace that ends in the middle of a record or a pass is reported in
+// result.truncatedAt and doesn't count as replayed either
+bool replayTrace(const uint8_t *trace, uint32_t length, Irrigation &irrigation, ReplayResult &result) {
+  const Irrigation settings = irrigation;
+  TraceRecord record;
+  TraceRecord expected;
+  uint32_t offset = 0;
+  uint8_t used;
+
+  memset(&result, 0, sizeof(result));
+  result.firstMismatch = -1;
+  result.truncatedAt = -1;
+
+  while (offset < length) {
+    used = readTraceRecord(trace + offset, length - offset, record);
+    if (used == 0) break;
+    uint32_t start = offset;
+    bool matched = true;
+    offset += used;
+    result.records++;
+
+    switch (record.type) {
+      case TRACE_BEGIN:
+        irrigation = settings;
+        applyTraceSetup(record.setup, irrigation);
+        irrigation.begin(record.at);
+        break;
+      case TRACE_FLOW:
+        irrigation.meter(record.at, record.pulses);
+        break;
+      case TRACE_PASS: {
+        // Every event handed out in this pass was followed by its readings
+        // or by the decision the device made
+        ScheduleEvent event;
+        result.passes++;
+        while (matched && irrigation.poll(record.at, event)) {
+          used = readTraceRecord(trace + offset, length - offset, expected);
+          if (used == 0) break;
+          // The device restarted before it finished the pass
+          if (expected.type == TRACE_BEGIN) break;
+          offset += used;
+          result.records++;
+          if (event.type == EVENT_SAMPLE) {
+            matched = expected.type == TRACE_INPUTS;
+            if (matched) irrigation.sample(expected.inputs);
+          }
+          else {
+            result.decisions++;
+            matched = expected.type == TRACE_DECISION && expected.event.at == event.at &&
+                      expected.event.type == event.type && expected.event.zone == event.zone;
+          }
+        }
+        if (used == 0) {
+          result.truncatedAt = offset;
+          return false;
+        }
+        break;
+      }
+      default:
+        // Readings or decisions outside of a pass mean the device handed
+        // out an event the replay didn't
+        matched = false;
+    }
+
+    if (!matched) {
+      result.mismatches++;
+      if (result.firstMismatch < 0) result.firstMismatch = start;
+      return false;
+    }
+  }
+  if (offset < length) {
+    result.truncatedAt = offset;
+    return false;
+  }
+  return result.mismatches == 0;
+}
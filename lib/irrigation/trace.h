@@ -0,0 +1,60 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <irrigation.h>
+
+// A trace is a stream of small binary records, one for every call the sketch
+// makes into the control code, in the order it made them. Multi-byte values
+// are little endian and floats are stored as their raw IEEE bits, so a trace
+// taken on the Mega replays bit for bit on a PC.
+enum TraceRecordType {
+  TRACE_BEGIN = 1, // settings and start time, written once at the end of setup()
+  TRACE_PASS,      // a pass through loop() that found events due
+  TRACE_INPUTS,    // the raw readings taken for an EVENT_SAMPLE
+  TRACE_FLOW,      // flow meter pulses collected
+  TRACE_DECISION   // a valve event handed out by the schedule
+};
+
+// The TRACE_BEGIN record is the largest
+#define TRACE_MAX_RECORD (1 + 4 + 1 + 4 * 4 + 4 * IRRIGATION_MAX_ZONES)
+
+struct TraceSetup {
+  uint8_t zones;
+  uint32_t runTime;
+  uint32_t irrigationTime;
+  float slope;
+  float intercept;
+  float thresholds[IRRIGATION_MAX_ZONES + 1];
+};
+
+struct TraceRecord {
+  uint8_t type;
+  uint32_t at;
+  TraceSetup setup;                   // TRACE_BEGIN
+  RawInputs inputs;                   // TRACE_INPUTS
+  uint16_t pulses[FLOW_MAX_METERS];   // TRACE_FLOW
+  ScheduleEvent event;                // TRACE_DECISION
+};
+
+uint8_t traceBegin(uint8_t *record, uint32_t now, const Irrigation &irrigation);
+uint8_t tracePass(uint8_t *record, uint32_t now);
+uint8_t traceInputs(uint8_t *record, const RawInputs &inputs, uint8_t zones);
+uint8_t traceFlow(uint8_t *record, uint32_t now, const uint16_t pulses[FLOW_MAX_METERS]);
+uint8_t traceDecision(uint8_t *record, const ScheduleEvent &event);
+
+uint8_t readTraceRecord(const uint8_t *trace, uint32_t length, TraceRecord &record);
+void applyTraceSetup(const TraceSetup &setup, Irrigation &irrigation);
+
+struct ReplayResult {
+  uint32_t records;
+  uint32_t passes;      // passes through loop() replayed
+  uint32_t decisions;   // valve events compared
+  uint32_t mismatches;
+  int32_t firstMismatch; // byte offset of the first record that didn't match, -1 if none
+  int32_t truncatedAt;   // byte offset of a record that was cut short or can't be read, -1 if none
+};
+
+bool replayTrace(const uint8_t *trace, uint32_t length, Irrigation &irrigation, ReplayResult &result);
+
+#endif
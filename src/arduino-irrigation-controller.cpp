@@ -29,6 +29,8 @@ CS - pin 53 to  SD shield: 10 (white)
 7) Relay drivers: Relays 1 - 14 are controlled by digital pins D22 - D35 (note: two relays are not used). The relay board also needs connections to GND and 5V on Arduino Mega.
 8) Relays should use reverse logic, what means LOW to open and HIGH to close in the program.
 9) The serial monitor allows users to see information on the computer screen.  It can be started by going to Tools > Serial monitor or by clicking Ctrl + Shift + M).
+10) Master valve/pump: Relay 15 (one of the two unused relays) is controlled by digital pin D36 and switches the master valve or pump relay, using the same reverse logic as the plot relays.
+11) Flow meter (optional): A pulse-output flow meter (e.g. a hall-effect meter) in the supply line after the master valve. Signal wire connected to digital pin D3 (one of the external interrupt pins on the Mega), power to 5V and ground to GND.
 
 UPDATES:
 1) Return instruction added to the system verification and RunTime and IrrigTime declared as unsigned long variables.
@@ -47,7 +49,10 @@ UPDATES:
 #include <ArduinoFake.h>
 #endif
 
-#include <irrigation.h>
+#include <controller.h>
+#include <block_log.h>
+#include <events.h>
+#include <relay_driver.h>
 
 
 #define N_SENSORS 1
@@ -57,40 +62,375 @@ UPDATES:
 #define DHTPIN 2  // pin D2
 #define DHTTYPE DHT11   // DHT22 == AM2302
 
+// Digital pin the flow meter signal is connected to. Needs to be an external interrupt pin (2, 3, 18, 19, 20 or 21 on the Mega)
+#define FLOW_PIN 3
+// Amount of water (in liters) that may pass the flow meter between two readings while all valves are closed before a warning is given
+#define FLOW_LEAK_LITERS 0.5
+
+// Digital pins of the green (OK) and red (bad sensor reading) LEDs
+#define LED_GREEN_PIN 8
+#define LED_RED_PIN 9
+
 // Declare variables for 14 sensors (numbered from #1 - #14). The number of variables needs to be sensor n+1 due to the counting starts on 0 instead of 1
-float VWC[15], Threshold[15], SubCalSlope, SubCalIntercept, h, t, e_sat, e, VPD;
-int sensorValue[15], Counter[15], i;
+float Threshold[15], SubCalSlope, SubCalIntercept;
+int i;
 unsigned long IrrigTime, RunTime;
-#ifndef NATIVE
-DHT dht(DHTPIN, DHTTYPE);
-#endif
 RTC_DS1307 rtc; // Note, if you're using a different RTC chip, you can just update the type here per https://adafruit.github.io/RTClib/html/_r_t_clib_8h_source.html
 
-Irrigation irrigation;
+// Called on every pulse of the flow meter (see MegaHardware::begin())
+void onFlowPulse();
+
+#ifndef NATIVE
+// Build with -DRECORD_TRACE (see platformio.ini) to record every reading, flow meter pulse and valve decision to trace.bin on the SD card. The trace can be replayed on a PC with the native tests to check the control code makes exactly the same decisions (see test/test_replay.cpp)
+
+// Build with -DLOG_CONTIGUOUS (see platformio.ini) to log to LOG.BIN instead of log.txt. LOG.BIN is created once as one contiguous file of LOG_BLOCKS blocks and then written block by block straight to the card, without going through the FAT (see lib/irrigation/block_log.h). Appending a row then takes the same time however large the log gets, and a power cut while writing loses at most the row being written instead of corrupting the file. Pull the card and read LOG.BIN with tools/read_block_log.py
+#define LOG_BLOCKS 131072UL // 64 MB
+#ifdef LOG_CONTIGUOUS
+// SdVolume keeps the card and its block cache in static members, so this volume works on the card SD.begin() set up. Its init() only reads the volume layout again (flushing the cache first), it never resets the card under the files SD has open
+SdVolume volume;
+SdFile root;
+
+// Raw access to the 512 byte blocks of the SD card
+class SdBlockDevice {
+  public:
+    bool readBlock(uint32_t block, uint8_t *data) {
+      return volume.sdCard()->readBlock(block, data);
+    }
+
+    bool writeBlock(uint32_t block, const uint8_t *data) {
+      return volume.sdCard()->writeBlock(block, data);
+    }
+};
+
+BlockLog<SdBlockDevice> blockLog;
+
+// Lets the code that writes the data file print to the block log. Every row is made durable when it is closed
+class BlockLogFile : public Print {
+  public:
+    size_t write(uint8_t c) {
+      return blockLog.write(&c, 1);
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) {
+      return blockLog.write(buffer, size);
+    }
 
-template <class T> void print(T msg) {
-  #ifndef NATIVE
-  Serial.print(msg);
-  #endif
+    operator bool() {
+      return blockLog.isReady();
+    }
+
+    void close() {
+      blockLog.sync();
+    }
+};
+
+// Open LOG.BIN on the card SD.begin() set up, creating it the first time, and pick up the log in it. A new log is only started in a new LOG.BIN or one without a log in it: tools/read_block_log.py only reads the newest log, so after a read error the file is left alone and the caller reports EV_DATA_FILE_FAILED
+bool openBlockLog() {
+  SdFile file;
+  uint32_t first, last;
+  bool created = false;
+  if (!volume.init(volume.sdCard()) || !root.openRoot(&volume)) return false;
+  if (!file.open(&root, "LOG.BIN", O_READ)) {
+    if (!file.createContiguous(&root, "LOG.BIN", LOG_BLOCKS * BLOCK_LOG_BLOCK_SIZE)) return false;
+    created = true;
+  }
+  // A LOG.BIN that was copied onto the card may not be contiguous
+  bool contiguous = file.contiguousRange(&first, &last);
+  file.close();
+  if (!contiguous) return false;
+  uint32_t count = last - first + 1;
+  if (created) return blockLog.format(first, count);
+  return blockLog.mount(first, count) || (blockLog.isBlank(first, count) && blockLog.format(first, count));
 }
+#endif
+
+// PORTA and PORTC, the ports the relays are on (see lib/irrigation/relay_driver.h). The port number is a constant everywhere it is used, so every call compiles down to a single in/out instruction
+class MegaPorts {
+  public:
+    uint8_t read(uint8_t port) {
+      return port == RELAY_PORT_A ? PORTA : PORTC;
+    }
+
+    void write(uint8_t port, uint8_t value) {
+      if (port == RELAY_PORT_A) PORTA = value;
+      else PORTC = value;
+    }
+
+    void output(uint8_t port, uint8_t bits) {
+      if (port == RELAY_PORT_A) DDRA |= bits;
+      else DDRC |= bits;
+    }
+};
+
+// How the controller reaches the hardware (see lib/irrigation/controller.h). Everything is inlined into the controller. The relays (pins 22 - 36) go through a RelayDriver: writePin() only marks them in its shadow copy of PORTA and PORTC, and commitPins() switches all of them with one store per port once the controller has carried out every event that is due. The fast zone timer interrupt switches its relays through the same shadow copy, so the main loop changes it with interrupts off. The rest of the sketch goes through it as well for the serial port, the LEDs and the SD card (events, data log and trace)
+class MegaHardware {
+  public:
+    #ifdef RECORD_TRACE
+    static const bool TRACE = true;
+    #else
+    static const bool TRACE = false;
+    #endif
+
+    #ifdef LOG_CONTIGUOUS
+    typedef BlockLogFile LogFile;
+    #else
+    typedef File LogFile;
+    #endif
+
+    MegaHardware() : dht(DHTPIN, DHTTYPE) {}
+
+    // Start the serial port, the RTC and the DHT, set up the LEDs and the flow meter. Returns false if the RTC wasn't running, it is then set to the date and time this sketch (program) was compiled
+    bool begin() {
+      Serial.begin(57600);
+      Wire.begin();
+      dht.begin();
+      rtc.begin();
+
+      // Set pins that control LEDs as output
+      pinMode(LED_GREEN_PIN, OUTPUT);
+      pinMode(LED_RED_PIN, OUTPUT);
+
+      // Count the flow meter pulses in an interrupt, so none are missed while the program is busy
+      pinMode(FLOW_PIN, INPUT_PULLUP);
+      attachInterrupt(digitalPinToInterrupt(FLOW_PIN), onFlowPulse, FALLING);
+
+      if (rtc.isrunning()) return true;
+      rtc.adjust(DateTime(__DATE__, __TIME__));
+      return false;
+    }
+
+    // See if the SD card is present and can be initialized, and start appending events to it (and open LOG.BIN with -DLOG_CONTIGUOUS, the data log then doesn't open if that fails). Returns false if there is no card
+    bool beginCard() {
+      // Pin to write to SD card, depends on SD board, check manufacturing specs (53 for Arduino Mega)
+      const int chipSelect = 53;
+      // Configure digital pin D10 (53?) as output. This pin is used by default for use with the SD shield (chipSelect)
+      pinMode(chipSelect, OUTPUT);
+      if (!SD.begin()) return false;
+      eventFile = SD.open("events.bin", FILE_WRITE);
+      #ifdef LOG_CONTIGUOUS
+      openBlockLog();
+      #endif
+      return true;
+    }
+
+    // Open the data file to append a row, close() it when the row is done
+    LogFile openLog() {
+      #ifdef LOG_CONTIGUOUS
+      return BlockLogFile();
+      #else
+      return SD.open("log.txt", FILE_WRITE);
+      #endif
+    }
+
+    // Open trace.bin to append the trace to. Returns false if it can't be opened
+    bool openTrace() {
+      #ifdef RECORD_TRACE
+      traceFile = SD.open("trace.bin", FILE_WRITE);
+      return traceFile;
+      #else
+      return false;
+      #endif
+    }
+
+    // Send an event record to the serial port (or its text, with -DEVENTS_TEXT) and append it to events.bin
+    void storeEvent(const uint8_t *record, uint8_t length) {
+      #ifdef EVENTS_TEXT
+      char text[EVENT_MAX_TEXT];
+      renderEvent(record, text, sizeof(text));
+      Serial.println(text);
+      #else
+      Serial.write(record, length);
+      #endif
+      if (eventFile) {
+        eventFile.write(record, length);
+        eventFile.flush();
+      }
+    }
+
+    // Green LED on while everything is fine, red LED on when a reading, the flow or a plot needs looking at
+    void showStatus(bool ok) {
+      digitalWrite(LED_GREEN_PIN, ok ? HIGH : LOW);
+      digitalWrite(LED_RED_PIN, ok ? LOW : HIGH);
+    }
+
+    // Run Timer 1 in CTC mode at 1 kHz (16 MHz / 64 / 250) for the fast zones
+    void startFastTimer() {
+      noInterrupts();
+      TCCR1A = 0;
+      TCCR1B = _BV(WGM12) | _BV(CS11) | _BV(CS10);
+      TCNT1 = 0;
+      OCR1A = F_CPU / 64 / 1000 - 1;
+      TIMSK1 |= _BV(OCIE1A);
+      interrupts();
+    }
+
+    // Keep the fast zone timer interrupt out while the main loop reads what it shares with it
+    void holdInterrupts() {
+      noInterrupts();
+    }
+
+    void releaseInterrupts() {
+      interrupts();
+    }
+
+    void outputPin(uint8_t pin) {
+      if (RelayDriver<MegaPorts>::isRelay(pin)) {
+        relays.output(pin);
+        return;
+      }
+      pinMode(pin, OUTPUT);
+    }
+
+    void writePin(uint8_t pin, bool high) {
+      if (RelayDriver<MegaPorts>::isRelay(pin)) {
+        noInterrupts();
+        relays.set(pin, !high);
+        interrupts();
+        return;
+      }
+      digitalWrite(pin, high ? HIGH : LOW);
+    }
+
+    void commitPins() {
+      noInterrupts();
+      relays.apply();
+      interrupts();
+    }
+
+    // Called from the fast zone timer interrupt. Only the fast zones' relays are written, changes the main loop has staged wait for commitPins()
+    void writeRelays(uint16_t zones, uint16_t open) {
+      relays.setMasked(zones, open);
+      relays.apply(zones);
+    }
+
+    // Measure the sensor of a plot. This gives a raw value between 0 and 1023. Sensors 1 - 4 are connected to A0 - A3, sensors 5 - 14 to A6 - A15
+    int16_t readMoisture(uint8_t zone) {
+      return analogRead(zone <= 4 ? zone - 1 : zone + 1);
+    }
+
+    // Measure the AM2302 temperature and relative humidity sensor. Reading temperature or humidity takes about 250 milliseconds. Sensor readings may also be up to 2 seconds 'old' (it is a very slow sensor)
+    void readEnvironment(float &humidity, float &temperature) {
+      humidity = dht.readHumidity();
+      temperature = dht.readTemperature();
+    }
+
+    uint32_t now() {
+      return rtc.now().secondstime();
+    }
+
+    void sleep(uint16_t ms) {
+      delay(ms);
+    }
+
+    // Append a record to the trace file. It is flushed straight away, so a power cut loses at most the record being written
+    void store(const uint8_t *record, uint8_t length) {
+      #ifdef RECORD_TRACE
+      if (traceFile) {
+        traceFile.write(record, length);
+        traceFile.flush();
+      }
+      #endif
+    }
+
+    RelayDriver<MegaPorts> relays;
+
+  private:
+    DHT dht;
+    File eventFile;
+    #ifdef RECORD_TRACE
+    File traceFile;
+    #endif
+};
+typedef MegaHardware Hardware;
+#else
+// Stands in for the Mega when the sketch is built for the native tests (see test/test_main.cpp). The pins go to ArduinoFake one by one, the DHT always reads 50% and 72 degrees, there is no fast zone timer and no SD card, so events, the data file and the trace are dropped. The control code itself is tested through test/SimHardware.h
+class NativeHardware {
+  public:
+    static const bool TRACE = false;
+
+    // A data file that never opens
+    class LogFile {
+      public:
+        template <class T> void print(T) {}
+        template <class T> void print(T, int) {}
+        void println() {}
+        template <class T> void println(T) {}
+        void close() {}
+        operator bool() { return false; }
+    };
+
+    bool begin() {
+      rtc.begin();
+      pinMode(LED_GREEN_PIN, OUTPUT);
+      pinMode(LED_RED_PIN, OUTPUT);
+      pinMode(FLOW_PIN, INPUT_PULLUP);
+      return true;
+    }
+    bool beginCard() { return false; }
+    LogFile openLog() { return LogFile(); }
+    bool openTrace() { return false; }
+    void storeEvent(const uint8_t *, uint8_t) {}
+    void showStatus(bool ok) {
+      digitalWrite(LED_GREEN_PIN, ok ? HIGH : LOW);
+      digitalWrite(LED_RED_PIN, ok ? LOW : HIGH);
+    }
+    void startFastTimer() {}
+    void holdInterrupts() {}
+    void releaseInterrupts() {}
+
+    void outputPin(uint8_t pin) {
+      pinMode(pin, OUTPUT);
+    }
+
+    void writePin(uint8_t pin, bool high) {
+      digitalWrite(pin, high ? HIGH : LOW);
+    }
+
+    void commitPins() {}
+    void writeRelays(uint16_t, uint16_t) {}
 
-template <class T> void println(T msg) {
-  #ifndef NATIVE
-  Serial.println(msg);
-  #endif
+    int16_t readMoisture(uint8_t zone) {
+      return analogRead(zone <= 4 ? zone - 1 : zone + 1);
+    }
+
+    void readEnvironment(float &humidity, float &temperature) {
+      humidity = 50.0;
+      temperature = 72.0;
+    }
+    uint32_t now() {
+      return rtc.now().secondstime();
+    }
+    void sleep(uint16_t ms) {
+      delay(ms);
+    }
+    void store(const uint8_t *, uint8_t) {}
+};
+typedef NativeHardware Hardware;
+#endif
+
+// The controller runs the schedule and switches the relays. The readings, VWC, irrigation counters, schedule, flow meter and fault detector all live in 'irrigation'
+Controller<Hardware> controller;
+Irrigation &irrigation = controller.irrigation;
+
+// Messages are not stored as text but as events from lib/irrigation/event_catalog.h: a few bytes with the event number, the time and the values that go into the message. The text stays in flash (it is only needed by whoever reads the events) and sending a record takes a fraction of the time printing the message would. Events go to the serial port and are appended to events.bin on the SD card. Use tools/decode_events.py to turn them back into text, or build with -DEVENTS_TEXT (see platformio.ini) to have the serial port show the text instead. The event is picked as a template argument, report<EV_LEAK>(liters), so arguments that don't match the catalog are a compile error
+template <EventId id, class... Args> void report(Args... args) {
+  uint8_t record[EVENT_MAX_RECORD];
+  uint8_t length = encodeEvent<id>(record, controller.hardware.now(), args...);
+  controller.hardware.storeEvent(record, length);
 }
 
-void print(float msg, int len) {
-  #ifndef NATIVE
-  Serial.print(msg, len);
-  #endif
+// Only queues the pulse, the main loop works out where the water went
+void onFlowPulse() {
+  irrigation.flow.pulse(0);
 }
 
-void println() {
-  #ifndef NATIVE
-  Serial.println();
-  #endif
+#ifndef NATIVE
+// Timer 1 interrupt, every millisecond while there are fast zones (see MegaHardware::startFastTimer())
+ISR(TIMER1_COMPA_vect) {
+  controller.fastTick(micros());
 }
+#endif
+
 void sleepyMethod() {
     //rtc.begin();
     //for (i = 22; i < 36; i = i + 1) {
@@ -133,69 +473,67 @@ void setup() {
   SubCalSlope = 1.1785;
   SubCalIntercept = -0.4938;
 
-  //***************************************************************************************//
-  //                     END OF SECTION WITH USER-CHANGEABLE SETPOINT                                                                          //
-  //     DO NOT MODIFY OTHER PARTS OF THE PROGRAM UNLESS YOU KNOW WHAT YOU'RE DOING                  //
-  //**************************************************************************************//
+  // WATERING WINDOWS: Irrigation will not take place during these times of day (start and end in minutes after midnight), e.g. 11:00 - 15:00 to avoid watering in the heat of the day. A window can run past midnight (e.g. 22*60 to 6*60). Plots that need water during a window are irrigated as soon as it ends. Up to 4 windows can be set
+  // irrigation.schedule.addBlackoutWindow(11*60, 15*60);
+
+  // BLACKOUT DAYS: Days on which no irrigation takes place at all. Use DAY_BIT(0) for Sunday up to DAY_BIT(6) for Saturday and combine them with |, e.g. DAY_BIT(0) | DAY_BIT(6) for weekends
+  irrigation.schedule.setBlackoutDays(0);
 
-  #ifndef NATIVE
-  Serial.begin(57600);
-  Wire.begin();
-  dht.begin();
-  #endif
-  rtc.begin();
+  // MASTER VALVE DELAY: Time (in seconds) between opening the master valve/starting the pump and opening the first plot valve, so the line can pressurize
+  irrigation.schedule.setMasterDelay(0);
 
+  // PRIORITIES: When several plots need water at the same time, they are irrigated one after the other, highest priority first. All plots start at priority 0
+  // irrigation.schedule.setPriority(1, 1);
 
+  // FLOW METER CALIBRATION: Number of pulses the flow meter gives per liter of water. Check the manual of your meter (450 for the common YF-S201 hall-effect meters)
+  irrigation.flow.setPulsesPerLiter(0, 450.0);
 
-  #ifndef NATIVE
+  // FLOW CUTOFF: Close a plot valve once it has received this volume (in liters) instead of after IrrigTime. IrrigTime then becomes the longest the valve may stay open, so set it generously. Leave it out (or set 0) to irrigate by time only
+  // irrigation.flow.setTargetVolume(1, 2.0);
 
-  // Check if the RTC is running. If not, show error message on serial monitor
-  if (! rtc.isrunning()) {
-    println("RTC is NOT running!");
-    // Following line sets the RTC to the date and time this sketch (program) was compiled
-    rtc.adjust(DateTime(__DATE__, __TIME__));
+  // FAST ZONES: Run a plot as a mist or ebb-and-flow zone instead of on its threshold. The valve opens every period (10 - 100 milliseconds) for the open time (in milliseconds), e.g. 50 and 10 opens it for 10 ms at 20 Hz. Fast zones are switched from a timer interrupt and don't go through the master valve, so put them on a supply line that doesn't need it. They follow the blackout windows and days like the other plots and are held closed while their plot is disabled with a fault. Their water isn't metered: while one is cycling, the pulses of its flow meter are ignored, so there is no leak check and no FLOW CUTOFF for the plots on that meter (they run for IrrigTime). Put fast zones on a meter of their own with irrigation.flow.setZoneMeter() to keep metering the other plots. The other plots keep running as usual
+  // irrigation.fast.setZone(3, 50, 10);
+
+  //***************************************************************************************//
+  //                     END OF SECTION WITH USER-CHANGEABLE SETPOINT                                                                          //
+  //     DO NOT MODIFY OTHER PARTS OF THE PROGRAM UNLESS YOU KNOW WHAT YOU'RE DOING                  //
+  //**************************************************************************************//
+
+  // Start the serial port, the RTC and the DHT, the LEDs and the flow meter. If the RTC isn't running, show error message on serial monitor, it is then set to the date and time this sketch (program) was compiled
+  if (!controller.hardware.begin()) {
+    report<EV_RTC_NOT_RUNNING>();
   }
   else {
     // If RTC has been started, send message to serial port
-    println("Real time clock initialized.");
+    report<EV_RTC_STARTED>();
   }
 
-  // Pin to write to SD card, depends on SD board, check manufacturing specs (53 for Arduino Mega)
-  const int chipSelect = 53;
-  // Configure digital pin D10 (53?) as output. This pin is used by default for use with the SD shield (chipSelect)
-  pinMode(chipSelect, OUTPUT);
-
-  // See if the SD card is present and can be initialized. If not, send an error message to the serial port and prevent the program from running. Send a message to the screen that the SD card is being initialized
-  print("Initializing SD card... ");
-
-  if (!SD.begin()) {
-    println("*******************************************");
-    println("       Card failed, or not present         ");
-    println("     WARNING: NO DATA WILL BE COLLECTED!   ");
-    println("CHECK CARD AND ALL CONNECTIONS TO SD SHIELD");
-    println("*******************************************");
+  // See if the SD card is present and can be initialized. If not, send an error message to the serial port and prevent the program from running
+  if (!controller.hardware.beginCard()) {
+    report<EV_SD_FAILED>();
   }
   else {
-    // If SD card is available, send message to serial port
-    println("SD card initialized.");
+    // If SD card is available, send message to serial port and the card
+    report<EV_SD_STARTED>();
   }
-  println();
 
   // Initialize file and write header
-  File dataFile = SD.open("log.txt", FILE_WRITE);
+  Hardware::LogFile dataFile = controller.hardware.openLog();
   // If the file is available, write headers to it
   if (dataFile) {
     dataFile.println();
-    dataFile.println("Date Time, temp, RH, e_sat, e, VPD, VWC[1], VWC[2], VWC[3], VWC[4], VWC[5], VWC[6], VWC[7], VWC[8], VWC[9], VWC[10], VWC[11], VWC[12], VWC[13], VWC[14], Counter[1], Counter[2], Counter[3], Counter[4], Counter[5], Counter[6], Counter[7], Counter[8], Counter[9], Counter[10], Counter[11], Counter[12], Counter[13], Counter[14]");
+    dataFile.println("Date Time, temp, RH, e_sat, e, VPD, VWC[1], VWC[2], VWC[3], VWC[4], VWC[5], VWC[6], VWC[7], VWC[8], VWC[9], VWC[10], VWC[11], VWC[12], VWC[13], VWC[14], Counter[1], Counter[2], Counter[3], Counter[4], Counter[5], Counter[6], Counter[7], Counter[8], Counter[9], Counter[10], Counter[11], Counter[12], Counter[13], Counter[14], Liters[1], Liters[2], Liters[3], Liters[4], Liters[5], Liters[6], Liters[7], Liters[8], Liters[9], Liters[10], Liters[11], Liters[12], Liters[13], Liters[14]");
     dataFile.println();
     dataFile.close();
   }
   // If the file is not open, pop up an error
   else {
-    println("error opening data file log.txt");
+    report<EV_DATA_FILE_FAILED>();
   }
-  #endif
 
+  if (Hardware::TRACE && !controller.hardware.openTrace()) {
+    report<EV_TRACE_FILE_FAILED>();
+  }
 
   // Configure digital pins D43 - D49 as outputs to apply voltage to all fourteen sensors (D43: sensor 1 and 2; D44, sensor 3 and 4, D45: sensor 5 and 6; D46: sensor 7 and 8; D47: sensor 9 and 10; D48: sensor 11 and 12; D49: sensor 13 and 14)
   // pinMode(43, OUTPUT);
@@ -206,300 +544,173 @@ void setup() {
   // pinMode(48, OUTPUT);
   // pinMode(49, OUTPUT);
 
-  // Set digital pins D22 - D35 HIGH. These digital pins control the relays. Setting these pins HIGH assures that the relays are open at the initial startup or when the Arduino is reseted
-  for (i = 22; i < 36; i = i + 1) {
-    digitalWrite(i, HIGH);
-    // Then set pins as outputs
-    pinMode(i, OUTPUT);
-  }
-
-  // Set pins that control LEDs as output
-  pinMode(8, OUTPUT);
-  pinMode(9, OUTPUT);
-
   // Use the internal 2.56 volt on the Mega board as the reference for all analog voltage measurements
   // analogReference(INTERNAL2V56);
 
-  irrigation.begin();
-}
-
-
-// ===========================================================================================
-
-void loop() {
-
-}
-
-
-
-// The following section (loop) of the program will run until the power is disconnected, at an interval specified by the 'RunTime'
-void loopOld() {
+  // Hand the settings over to the control code and start the schedule. The first readings are taken right away
+  irrigation.setZones(N_SENSORS);
+  irrigation.setRunTime(RunTime);
+  irrigation.setIrrigationTime(IrrigTime);
+  irrigation.setCalibration(SubCalSlope, SubCalIntercept);
+  for (i = 1; i <= N_SENSORS; i++) {
+    irrigation.setThreshold(i, Threshold[i]);
+  }
+  // Set digital pins D22 - D36 HIGH and then make them outputs. These digital pins control the relays. Setting these pins HIGH assures that the relays are open at the initial startup or when the Arduino is reseted
+  controller.begin();
 
-  // Check to make sure that the frequency at which the program runs (RunTime) is at least 15x longer than the irrigation duration (IrrigTime)
-  if (RunTime < IrrigTime*15) {
-    println("**********************************************");
-    println("WARNING: RunTime is too short. Please increase");
-    println("WARNING: THE PROGRAM WILL NOT RUN CORRECTLY!");
-    println("**********************************************");
-    return;
+  // Start switching the fast zones, if there are any
+  if (irrigation.fast.zones()) {
+    irrigation.fast.start();
+    controller.hardware.startFastTimer();
   }
+}
 
-  // Check the current date and time
-  DateTime now = rtc.now();
 
-  #ifndef NATIVE
-  // Measure the AM2302 temperature and relative humidity sensor. Reading temperature or humidity takes about 250 milliseconds. Sensor readings may also be up to 2 seconds 'old' (it is a very slow sensor)
-  h = dht.readHumidity();
-  t = dht.readTemperature();
-  #else
-  h = 50.0;
-  t = 72.0;
-  #endif
-
-  // Check if returns are valid, if they are NaN (not a number) then something went wrong
-  if (isnan(t) || isnan(h)) {
-    println("Failed to read from DHT");
-  }
+// ===========================================================================================
 
-  // Calculate saturation vapor pressure from the measured temperature
-  e_sat = 0.6112*exp((17.67*t)/(t+243.5));
-  // Calculate vapor pressure from saturated vapor pressure
-  e = e_sat*h/100;
-  // Calculate the vapor pressure deficit (VPD) from saturated and actual vapor pressure
-  VPD = e_sat-e;
-
-  // Turn on the green LED to show that the system is executing the program
-  digitalWrite(8, HIGH);
-  // And turn the red LED off so that it can be used later in the program to check all sensor readings
-  digitalWrite(9, LOW);
-
-  // Measure all the sensors. This gives a raw value between 0 and 1023. Because of limited power available from the digital pins on the Arduino Mega, 7 pins are used to power the 14 sensors (each pin powers two sensors)
-  // Power sensor 1 and 2
-  // digitalWrite(43, HIGH);
-  // Wait 10 ms
-  delay(10);
-  // Measure sensor 1 and 2
-  sensorValue[1] = analogRead(0);
-  // sensorValue[2] = analogRead(1);
-  // And turn the power to the sensors off
-  // digitalWrite(43, LOW);
-
-  //
-  //
-  // // Now repeat this process for the rest of the sensors
-  // // Sensor 3 and 4
-  // digitalWrite(44, HIGH);
-  // delay(10);
-  // sensorValue[3] = analogRead(2);
-  // sensorValue[4] = analogRead(3);
-  // digitalWrite(44, LOW);
-  //
-  // // Sensor 5 and 6
-  // digitalWrite(45, HIGH);
-  // delay(10);
-  // sensorValue[5] = analogRead(6);
-  // sensorValue[6] = analogRead(7);
-  // digitalWrite(45, LOW);
-  //
-  // // Sensor 7 and 8
-  // digitalWrite(46, HIGH);
-  // delay(10);
-  // sensorValue[7] = analogRead(8);
-  // sensorValue[8] = analogRead(9);
-  // digitalWrite(46, LOW);
-  //
-  // // Sensor 9 and 10
-  // digitalWrite(47, HIGH);
-  // delay(10);
-  // sensorValue[9] = analogRead(10);
-  // sensorValue[10] = analogRead(11);
-  // digitalWrite(47, LOW);
-  //
-  // // Sensor 11 and 12
-  // digitalWrite(48, HIGH);
-  // delay(10);
-  // sensorValue[11] = analogRead(12);
-  // sensorValue[12] = analogRead(13);
-  // digitalWrite(48, LOW);
-  //
-  // // Sensor 13 and 14
-  // digitalWrite(49, HIGH);
-  // delay(10);
-  // sensorValue[13] = analogRead(14);
-  // sensorValue[14] = analogRead(15);
-  // digitalWrite(49, LOW);
-
-
-
-  // For all 14 sensors (i goes from 1 - 14)
+// Write an error message to the screen, turn on the red LED, and turn off the green LED when a particular sensor is reading too low or too high
+void checkRange() {
   for (i = 1; i <= N_SENSORS; i++) {
-    // Convert the measured raw values to VWC using a calibration equation. Note the 2.56 is the reference voltage used for all analog measurements. Raw value of 0 = 0V, 1023 = 2.56V
-    // VWC[i] = sensorValue[i] * (2.56/1023.0) * SubCalSlope + SubCalIntercept;
-    VWC[i] = sensorValue[i]/ 10;
-    // Write an error message to the screen, turn on the red LED, and turn off the green LED when a particular sensor is reading too low
-    if (VWC[i] < 0) {
-      print("WARNING: Sensor ");
-      print(i);
-      print(" out of range (too low). Current reading: ");
-      print(VWC[i]);
-      println(" m3/m3");
-      digitalWrite(8,LOW);
-      digitalWrite(9,HIGH);
+    if (irrigation.vwc(i) < 0) {
+      report<EV_SENSOR_LOW>((uint8_t)i, irrigation.vwc(i));
+      controller.hardware.showStatus(false);
     }
     // ... or too high
-    if (VWC[i] > 0.8) {
-      print("WARNING: Sensor ");
-      print(i);
-      print(" out of range (too high). Current reading: ");
-      print(VWC[i]);
-      println(" m3/m3");
-      digitalWrite(8,LOW);
-      digitalWrite(9,HIGH);
+    if (irrigation.vwc(i) > 0.8) {
+      report<EV_SENSOR_HIGH>((uint8_t)i, irrigation.vwc(i));
+      controller.hardware.showStatus(false);
     }
   }
+}
 
-  // PRINT THE DATE AND TIME STAMP TO THE SERIAL MONITOR TO THE SERIAL PORT
-  // Note the software has a quirk: Whenever the month/day/hour/minute/second is less then 10, by default it will use a single digit (e.g., '3' instead of '03'). That can result in odd formatting of the time or date. So whenever the value is less than 10, we first write a 0, followed by the single digit. This fixes the formatting. Note: Serial.print commands write information to the same line on the screen. Serial.println prints information and then goes to a new line. To send characters to the screen use '…', and to send text to the screen use "...". The value of variables can be written to screen by using the name of that variable (not in quotation marks)
-  // Start with showing date and time
-  // Write the month to the screen
-  if (now.month() < 10) print('0');
-  print(now.month(), DEC);
-  print('/');
-  // Write the day to the screen
-  if (now.day() < 10) print('0');
-  print(now.day(), DEC);
-  print('/');
-  // Write the year to the screen
-  print(now.year(), DEC);
-  print(' ');
-  // Write the hour to the screen
-  print(now.hour(), DEC);
-  print(':');
-  // Write the minute to the screen
-  if (now.minute() < 10) print('0');
-  print(now.minute(), DEC);
-  print(':');
-  // Write the second to the screen
-  if (now.second() < 10) print('0');
-  print(now.second(), DEC);
-  print(", ");
-  println();
-
-  // On the next line, show relative humidity, temperature, saturation vapor pressure, vapor pressure and VPD
-  print("Humidity: ");
-  print(h);
-  print("%, Temperature: ");
-  print(t);
-  print(" *C, e_sat: ");
-  print(e_sat);
-  print(" kPa, e: ");
-  print(e);
-  print(" kPa, VPD: ");
-  print(VPD);
-  println(" kPa");
-
-  // On the next line, show the measured substrate VWC
-  print("VWC (m3/m3): ");
-  for (i = 1; i <= N_SENSORS; i++) {
-    println();
-    print("Plot #");
-    print(i);
-    print(" = ");
-    print(VWC[i]);
-    print(", ");
-  }
-  println();
-
-  // On the next line, show the number of irrigations
-  print("Number of irrigations: ");
-  for (i = 1; i <= N_SENSORS; i++) {
-    println();
-    print("Plot #");
-    print(i);
-    print(" = ");
-    print(Counter[i]);
-    print(", ");
-  }
-  println();
-  println();
-
-  // For all 14 sensors (i goes from 1 - 14)
+// Report the environmental conditions, and the VWC, number of irrigations and water delivered for every plot. The events carry the time, so the date no longer has to be printed
+void printReadings() {
+  report<EV_ENVIRONMENT>(irrigation.humidity, irrigation.temperature, irrigation.eSat, irrigation.e, irrigation.vpd);
   for (i = 1; i <= N_SENSORS; i++) {
-    // Determine whether the measured VWC is below the threshold (and irrigation is needed), and, if so, turn the digital pin LOW (which closes the NO and COM connection at the relay and opens the corresponding valve). Note: the i+21 refers to the fact that irrigation in plot 1 is controlled by digital pin 22, plot 2 by pin 23, etc. Those pins are defined at the start of the program
-    if (VWC[i] < Threshold[i]) {
-      digitalWrite(i+21, LOW);
-      print("Plot ");
-      print(i);
-      print(" irrigation started. ");
-      delay(IrrigTime*1000);
-      println("Irrigation finished.");
-      digitalWrite(i+21, HIGH);
-      Counter[i] = Counter[i]+1;
-    }
-    // And if irrigation is not needed
-    else {
-      // The program simply pauses for the specified irrigation time. This is done to assure that the program takes the same amount of time to run regardless of which plots get irrigated
-      delay(IrrigTime*1000);
-      // And send a message to the screen that the plot does not need irrigation
-      print("Plot #");
-      print(i);
-      println(" does not need irrigation.");
-    }
+    report<EV_PLOT_READING>((uint8_t)i, irrigation.vwc(i), (uint16_t)irrigation.counter(i), irrigation.flow.liters(i));
   }
+}
 
-  println();
-  println("************************************************************************");
-  println();
+// Start a new line in the data file with the current date and time
+void logTimestamp(Hardware::LogFile &dataFile, DateTime now) {
+  dataFile.println();
+  dataFile.print(now.year(), DEC);
+  dataFile.print('/');
+  dataFile.print(now.month(), DEC);
+  dataFile.print('/');
+  dataFile.print(now.day(), DEC);
+  dataFile.print(' ');
+  dataFile.print(now.hour(), DEC);
+  dataFile.print(':');
+  if (now.minute() <10) dataFile.print('0');
+  dataFile.print(now.minute(), DEC);
+  dataFile.print(':');
+  if (now.second() <10) dataFile.print('0');
+  dataFile.print(now.second(), DEC);
+}
 
-  #ifndef NATIVE
+// Append the latest readings to the data file on the SD card
+void logReadings(DateTime now) {
   // THE FOLLOWING SECTION IS FOR SAVING AND COLLECTING DATA ON THE SD CARD
   // Open the data file on the SD card
-  File dataFile = SD.open("log.txt", FILE_WRITE);
+  Hardware::LogFile dataFile = controller.hardware.openLog();
   // If the file is available, write to it
   if (dataFile) {
     // Start with writing current time to the output file
-    dataFile.println();
-    dataFile.print(now.year(), DEC);
-    dataFile.print('/');
-    dataFile.print(now.month(), DEC);
-    dataFile.print('/');
-    dataFile.print(now.day(), DEC);
-    dataFile.print(' ');
-    dataFile.print(now.hour(), DEC);
-    dataFile.print(':');
-    if (now.minute() <10) dataFile.print('0');
-    dataFile.print(now.minute(), DEC);
-    dataFile.print(':');
-    if (now.second() <10) dataFile.print('0');
-    dataFile.print(now.second(), DEC);
+    logTimestamp(dataFile, now);
     // Now write a comma. This will result in a comma-delimited file, which is easily imported into spreadsheets
     dataFile.print(", ");
     // Write environmental conditions to the output file
-    dataFile.print(t);
+    dataFile.print(irrigation.temperature);
     dataFile.print(", ");
-    dataFile.print(h);
+    dataFile.print(irrigation.humidity);
     dataFile.print(", ");
-    dataFile.print(e_sat);
+    dataFile.print(irrigation.eSat);
     dataFile.print(", ");
-    dataFile.print(e);
+    dataFile.print(irrigation.e);
     dataFile.print(", ");
-    dataFile.print(VPD);
+    dataFile.print(irrigation.vpd);
     dataFile.print(", ");
     // Write substrate volumetric water contents to the output file (14 values)
     for (i = 1; i <= N_SENSORS; i++) {
-      dataFile.print(VWC[i]);
+      dataFile.print(irrigation.vwc(i));
       dataFile.print(", ");
     }
     // Write the number of irrigations to the output file (14 values)
     for (i = 1; i <= N_SENSORS; i++) {
-      dataFile.print(Counter[i]);
+      dataFile.print(irrigation.counter(i));
+      dataFile.print(", ");
+    }
+    // Write the liters delivered to each plot to the output file (14 values)
+    for (i = 1; i <= N_SENSORS; i++) {
+      dataFile.print(irrigation.flow.liters(i));
       dataFile.print(", ");
     }
     dataFile.close();
   }
-  #endif
+}
+
+// Report how well the fast zones kept their timing since the last readings: how many valve switches were a full tick (1 ms) or more late, and how late the others were
+void reportFastTiming() {
+  FastStats stats;
+  if (!irrigation.fast.zones()) return;
+  controller.hardware.holdInterrupts();
+  irrigation.fast.stats(stats);
+  irrigation.fast.resetStats();
+  controller.hardware.releaseInterrupts();
+  report<EV_FAST_TIMING>(stats.switches, stats.missed, stats.maxLateUs, (uint16_t)(stats.onTime ? stats.totalLateUs / stats.onTime : 0));
+}
+
+// Report an event the controller has carried out: print and log a new set of readings and warn about anything that looks wrong, or report a plot valve being opened or closed. Which plots need water, and when they get it, is decided by the controller
+void handleEvent(const ScheduleEvent &event, DateTime now) {
+  float leak;
+  uint8_t fault;
+  switch (event.type) {
+    case EVENT_SAMPLE:
+      // Turn on the green LED to show that the system is executing the program, and turn the red LED off so that it can be used later in the program to check all sensor readings
+      controller.hardware.showStatus(true);
+      // Check if returns are valid, if they are NaN (not a number) then something went wrong
+      if (isnan(irrigation.temperature) || isnan(irrigation.humidity)) {
+        report<EV_DHT_FAILED>();
+      }
+      checkRange();
+      // Water flowing while all valves were closed means a valve is stuck open or a line is leaking. The line filling while the master valve opens and draining right after a plot closes don't count
+      leak = irrigation.flow.takeUnattributed(0);
+      if (leak > FLOW_LEAK_LITERS) {
+        report<EV_LEAK>(leak);
+        controller.hardware.showStatus(false);
+      }
+      // Every plot is checked for a stuck sensor, a valve that doesn't wet the bed or a sudden jump in the reading. A plot with a fault is disabled and no longer irrigated, and the red LED stays on
+      for (i = 1; i <= N_SENSORS; i++) {
+        fault = irrigation.tripped(i);
+        if (fault != FAULT_NONE) {
+          report<EV_PLOT_DISABLED>((uint8_t)i, fault);
+        }
+        if (irrigation.faults.isDisabled(i)) {
+          controller.hardware.showStatus(false);
+        }
+      }
+      printReadings();
+      reportFastTiming();
+      logReadings(now);
+      break;
+    case EVENT_ZONE_OPEN:
+      report<EV_ZONE_STARTED>(event.zone);
+      break;
+    case EVENT_ZONE_CLOSE:
+      report<EV_ZONE_FINISHED>(event.zone, irrigation.flow.runLiters(event.zone));
+      break;
+  }
+}
+
+// The following section (loop) of the program will run until the power is disconnected. Rather than running everything every 'RunTime' it only wakes up when the schedule has something due: a new set of readings every 'RunTime' seconds (see irrigation.sample() for how the readings are turned into VWC and irrigation requests), or the master valve or a plot valve being opened or closed (possibly early, once a plot has received its target volume). In between, the controller collects the flow meter pulses and checks the RTC at least every minute
+void loop() {
+  DateTime now = rtc.now();
+  ScheduleEvent event;
+
+  while (controller.step(event)) {
+    handleEvent(event, now);
+  }
 
-  // The program will run approximately as often as specified by the RunTime (at start of program). When this delay has passed, the program will run again. RunTime and IrrigTime are multiplied by 1,000 to convert it from seconds to milliseconds. 785 is an estimate of how long it takes the program to run (785 milliseconds to collect and process the data, not counting the irrigation delays). This may be a few milliseconds off, but should be very close
-  // TODO: Don't forget to put this line back in when done
-  // delay(RunTime*1000 - (IrrigTime*1000*14) - 785);
+  controller.idle();
 }
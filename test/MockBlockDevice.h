@@ -0,0 +1,60 @@
+#ifdef NATIVE
+
+#ifndef _MOCK_BLOCK_DEVICE_H_
+#define _MOCK_BLOCK_DEVICE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#define MOCK_BLOCK_SIZE 512 ///< Bytes per block, as on an SD card
+
+/*!
+    @brief  In-memory block device for BlockLog that can lose power.
+
+    Set cutAt to the number of a write (counting from 0) to cut the power
+    during that write: only the first tornBytes of the block reach the
+    device, the write fails and so does every access after it, like a card
+    whose supply dropped. Copy the image into a fresh device to "reboot".
+*/
+class MockBlockDevice {
+public:
+  MockBlockDevice() : writes(0), reads(0), cutAt(-1), tornBytes(0), powered(true) {}
+
+  /*!
+      @brief  Give the device a number of blocks, filled with a byte pattern.
+      @param  blocks Number of blocks.
+      @param  fill Value of every byte.
+  */
+  void resize(uint32_t blocks, uint8_t fill = 0xFF) { image.assign(blocks * MOCK_BLOCK_SIZE, fill); }
+
+  bool readBlock(uint32_t block, uint8_t *data) {
+    if (!powered || (block + 1) * MOCK_BLOCK_SIZE > image.size()) return false;
+    reads++;
+    memcpy(data, &image[block * MOCK_BLOCK_SIZE], MOCK_BLOCK_SIZE);
+    return true;
+  }
+
+  bool writeBlock(uint32_t block, const uint8_t *data) {
+    if (!powered || (block + 1) * MOCK_BLOCK_SIZE > image.size()) return false;
+    if ((int32_t)writes == cutAt) {
+      memcpy(&image[block * MOCK_BLOCK_SIZE], data, tornBytes);
+      powered = false;
+      return false;
+    }
+    writes++;
+    memcpy(&image[block * MOCK_BLOCK_SIZE], data, MOCK_BLOCK_SIZE);
+    return true;
+  }
+
+  std::vector<uint8_t> image;
+  uint32_t writes;    ///< Completed writes
+  uint32_t reads;     ///< Completed reads
+  int32_t cutAt;      ///< Write during which the power is cut, -1 for never
+  uint16_t tornBytes; ///< Bytes of that write that make it to the device
+  bool powered;
+};
+
+#endif // _MOCK_BLOCK_DEVICE_H_
+
+#endif
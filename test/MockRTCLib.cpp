@@ -6,6 +6,21 @@
 const uint8_t daysInMonth[] PROGMEM = {31, 28, 31, 30, 31, 30,
                                        31, 31, 30, 31, 30};
 
+static uint16_t date2days(uint16_t y, uint8_t m, uint8_t d) {
+  if (y >= 2000U)
+    y -= 2000U;
+  uint16_t days = d;
+  for (uint8_t i = 1; i < m; ++i)
+    days += pgm_read_byte(daysInMonth + i - 1);
+  if (m > 2 && y % 4 == 0)
+    ++days;
+  return days + 365 * y + (y + 3) / 4 - 1;
+}
+
+static uint32_t time2ulong(uint16_t days, uint8_t h, uint8_t m, uint8_t s) {
+  return ((days * 24UL + h) * 60 + m) * 60 + s;
+}
+
 
 DateTime::DateTime(uint32_t t) {
   t -= SECONDS_FROM_1970_TO_2000; // bring to 2000 timestamp from 1970
@@ -70,6 +85,17 @@ DateTime::DateTime(const DateTime &copy)
     : yOff(copy.yOff), m(copy.m), d(copy.d), hh(copy.hh), mm(copy.mm),
       ss(copy.ss) {}
 
+/**************************************************************************/
+/*!
+    @brief  Convert the DateTime to seconds since 1 Jan 2000
+    @return Number of seconds since 2000-01-01 00:00:00.
+*/
+/**************************************************************************/
+uint32_t DateTime::secondstime(void) const {
+  uint16_t days = date2days(yOff, m, d);
+  return time2ulong(days, hh, mm, ss);
+}
+
 
 
 boolean RTC_DS1307::begin(void) {
@@ -0,0 +1,87 @@
+#ifdef NATIVE
+
+#ifndef _SIM_HARDWARE_H_
+#define _SIM_HARDWARE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <functional>
+#include <vector>
+#include <controller.h>
+
+#define SIM_PINS 70 ///< Digital pins on the Mega
+
+/*!
+    @brief  Simulated hardware policy for Controller, on a virtual clock.
+
+    Pin states are kept in memory, the moisture sensors and the DHT read
+    whatever the test puts in, and sleep() only moves the clock forward.
+    onSleep is called for every sleep() so a test can run a model of the
+    beds (or feed the flow meter) while the controller is waiting. Every
+    trace record is kept in 'trace'.
+*/
+class SimHardware {
+public:
+  static const bool TRACE = true;
+
+  SimHardware() : start(0), elapsedMs(0), humidity(50), temperature(20), writes(0), commits(0) {
+    memset(pins, 0, sizeof(pins));
+    memset(outputs, 0, sizeof(outputs));
+    memset(moisture, 0, sizeof(moisture));
+  }
+
+  void outputPin(uint8_t pin) { outputs[pin] = true; }
+  void writePin(uint8_t pin, bool high) {
+    pins[pin] = high;
+    writes++;
+  }
+  void commitPins() { commits++; }
+  void writeRelays(uint16_t zones, uint16_t open) {
+    for (uint8_t zone = 1; zone <= IRRIGATION_MAX_ZONES; zone++) {
+      if (zones & (1 << zone)) pins[CONTROLLER_RELAY_PIN(zone)] = !(open & (1 << zone));
+    }
+  }
+  int16_t readMoisture(uint8_t zone) { return moisture[zone]; }
+  void readEnvironment(float &h, float &t) {
+    h = humidity;
+    t = temperature;
+  }
+  uint32_t now() { return start + elapsedMs / 1000; }
+  void sleep(uint16_t ms) {
+    elapsedMs += ms;
+    if (onSleep) onSleep(ms);
+  }
+  void store(const uint8_t *record, uint8_t length) {
+    trace.insert(trace.end(), record, record + length);
+  }
+
+  /*!
+      @brief  Whether a relay is switched on (an output driven LOW).
+      @param  pin Digital pin of the relay.
+      @return True if the valve on that relay is open.
+  */
+  bool relayOn(uint8_t pin) const { return outputs[pin] && !pins[pin]; }
+  /*!
+      @brief  Whether water reaches a zone: its valve and the master are open.
+      @param  zone Zone (plot) number, 1 based.
+  */
+  bool watering(uint8_t zone) const {
+    return relayOn(CONTROLLER_MASTER_PIN) && relayOn(CONTROLLER_RELAY_PIN(zone));
+  }
+
+  uint32_t start;      ///< Clock at elapsedMs 0, RTC seconds since 2000
+  uint64_t elapsedMs;  ///< Virtual time slept so far
+  bool pins[SIM_PINS];
+  bool outputs[SIM_PINS];
+  int16_t moisture[IRRIGATION_MAX_ZONES + 1]; ///< Raw reading per zone
+  float humidity;
+  float temperature;
+  uint32_t writes;     ///< Number of writePin() calls
+  uint32_t commits;    ///< Number of commitPins() calls
+  std::vector<uint8_t> trace;
+  std::function<void(uint16_t)> onSleep;
+};
+
+#endif // _SIM_HARDWARE_H_
+
+#endif
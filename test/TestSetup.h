@@ -0,0 +1,31 @@
+#ifdef NATIVE
+
+#ifndef _TEST_SETUP_H_
+#define _TEST_SETUP_H_
+
+#include <stdint.h>
+#include <irrigation.h>
+
+/// Monday 2021-03-01 00:00:00 in seconds since 2000-01-01, where the
+/// simulated clocks and seasons start
+#define MONDAY 667872000UL
+
+/*!
+    @brief  Set up plots 1 - zones the way the tests run them.
+    @param  irrigation      Control code to set up.
+    @param  zones           Number of plots.
+    @param  threshold       VWC below which every plot asks for water.
+    @param  irrigationTime  Seconds a plot valve stays open.
+    @param  runTime         Seconds between two sets of readings.
+*/
+inline void setupPlots(Irrigation &irrigation, uint8_t zones, float threshold = 30,
+                       uint32_t irrigationTime = 60, uint32_t runTime = 1800) {
+  irrigation.setZones(zones);
+  irrigation.setRunTime(runTime);
+  irrigation.setIrrigationTime(irrigationTime);
+  for (uint8_t zone = 1; zone <= zones; zone++) irrigation.setThreshold(zone, threshold);
+}
+
+#endif // _TEST_SETUP_H_
+
+#endif
@@ -0,0 +1,100 @@
+#ifdef NATIVE
+
+#ifndef _WORK_STEALING_POOL_H_
+#define _WORK_STEALING_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*!
+    @brief  Runs independent jobs on every host core.
+
+    Jobs are numbered 0 - count-1 and dealt out to the workers up front, in
+    contiguous runs. A worker takes jobs from the back of its own queue and,
+    once that is empty, steals from the front of the others. A run of slow
+    jobs (long seasons, configurations that irrigate a lot) then gets spread
+    over the idle workers instead of holding up the whole sweep. Jobs don't
+    add jobs, so a worker that finds every queue empty is done.
+*/
+class WorkStealingPool {
+public:
+  /*!
+      @param  threads Number of workers, 0 for one per hardware thread.
+  */
+  explicit WorkStealingPool(unsigned threads = 0) : steals(0) {
+    workers = threads ? threads : std::thread::hardware_concurrency();
+    if (workers == 0) workers = 1;
+  }
+
+  /*!
+      @brief  Run job(index, worker) for every index in 0 - count-1.
+      @param  count Number of jobs.
+      @param  job Called once per index, from worker 'worker'
+              (0 - threads()-1). Calls run concurrently.
+  */
+  void run(size_t count, const std::function<void(size_t, unsigned)> &job) {
+    std::vector<Queue> queues(workers);
+    for (unsigned worker = 0; worker < workers; worker++) {
+      for (size_t index = count * worker / workers; index < count * (worker + 1) / workers; index++) {
+        queues[worker].jobs.push_back(index);
+      }
+    }
+
+    std::vector<std::thread> threads;
+    for (unsigned worker = 1; worker < workers; worker++) {
+      threads.push_back(std::thread(&WorkStealingPool::work, this, std::ref(queues), worker, std::cref(job)));
+    }
+    work(queues, 0, job);
+    for (size_t n = 0; n < threads.size(); n++) threads[n].join();
+  }
+
+  unsigned threads() const { return workers; }
+
+  std::atomic<uint32_t> steals; ///< Jobs taken from another worker's queue
+
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<size_t> jobs;
+  };
+
+  void work(std::vector<Queue> &queues, unsigned worker, const std::function<void(size_t, unsigned)> &job) {
+    size_t index;
+    while (take(queues[worker], false, index) || steal(queues, worker, index)) job(index, worker);
+  }
+
+  bool steal(std::vector<Queue> &queues, unsigned worker, size_t &index) {
+    for (unsigned n = 1; n < workers; n++) {
+      if (take(queues[(worker + n) % workers], true, index)) {
+        steals++;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static bool take(Queue &queue, bool front, size_t &index) {
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.jobs.empty()) return false;
+    if (front) {
+      index = queue.jobs.front();
+      queue.jobs.pop_front();
+    } else {
+      index = queue.jobs.back();
+      queue.jobs.pop_back();
+    }
+    return true;
+  }
+
+  unsigned workers;
+};
+
+#endif // _WORK_STEALING_POOL_H_
+
+#endif
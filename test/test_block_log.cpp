@@ -0,0 +1,199 @@
+#ifdef NATIVE
+
+#include <unity.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+#include <block_log.h>
+#include "MockBlockDevice.h"
+
+#define REGION_FIRST 8
+#define REGION_BLOCKS 64
+
+typedef BlockLog<MockBlockDevice> Log;
+
+// A row of a few dozen bytes, different for every row
+static std::vector<uint8_t> row(uint32_t number) {
+  char text[96];
+  int length = snprintf(text, sizeof(text), "2021/3/%u 12:%02u:00, 21.5, 55.0, 2.56, 1.41, 1.15, %u, %u\n",
+                        (unsigned)(number % 28 + 1), (unsigned)(number % 60), (unsigned)(number * 7 % 400),
+                        (unsigned)number);
+  return std::vector<uint8_t>(text, text + length);
+}
+
+// Everything the log holds, read back block by block
+static std::vector<uint8_t> contents(Log &log) {
+  std::vector<uint8_t> data;
+  uint8_t block[BLOCK_LOG_BLOCK_SIZE];
+  for (uint32_t index = 0; index * BLOCK_LOG_PAYLOAD < log.size(); index++) {
+    uint16_t used = log.read(index, block);
+    data.insert(data.end(), block + BLOCK_LOG_HEADER, block + BLOCK_LOG_HEADER + used);
+  }
+  return data;
+}
+
+static void reboot(Log &from, Log &to, uint32_t blocks = REGION_BLOCKS) {
+  to.device.image = from.device.image;
+  TEST_ASSERT_TRUE(to.mount(REGION_FIRST, blocks));
+}
+
+void test_block_log_needs_format(void) {
+  Log log;
+  log.device.resize(REGION_FIRST + REGION_BLOCKS);
+  TEST_ASSERT_FALSE(log.mount(REGION_FIRST, REGION_BLOCKS));
+  TEST_ASSERT_FALSE(log.isReady());
+  TEST_ASSERT_EQUAL(0, log.write((const uint8_t *)"x", 1));
+  TEST_ASSERT_TRUE(log.isBlank(REGION_FIRST, REGION_BLOCKS));
+
+  TEST_ASSERT_TRUE(log.format(REGION_FIRST, REGION_BLOCKS));
+  TEST_ASSERT_EQUAL(0, log.size());
+  TEST_ASSERT_EQUAL((REGION_BLOCKS - 3) * BLOCK_LOG_PAYLOAD, log.capacity());
+
+  Log after;
+  reboot(log, after);
+  TEST_ASSERT_EQUAL(0, after.size());
+  TEST_ASSERT_FALSE(after.isBlank(REGION_FIRST, REGION_BLOCKS));
+}
+
+// A card that fails to read is no reason to throw the log on it away
+void test_block_log_read_error_is_not_blank(void) {
+  Log log;
+  log.device.resize(REGION_FIRST + REGION_BLOCKS);
+  TEST_ASSERT_TRUE(log.format(REGION_FIRST, REGION_BLOCKS));
+  log.write((const uint8_t *)"kept", 4);
+  TEST_ASSERT_TRUE(log.sync());
+
+  Log after;
+  after.device.image = log.device.image;
+  after.device.powered = false;
+  TEST_ASSERT_FALSE(after.mount(REGION_FIRST, REGION_BLOCKS));
+  TEST_ASSERT_FALSE(after.isBlank(REGION_FIRST, REGION_BLOCKS));
+  after.device.powered = true;
+  TEST_ASSERT_TRUE(after.mount(REGION_FIRST, REGION_BLOCKS));
+  TEST_ASSERT_EQUAL(4, after.size());
+}
+
+void test_block_log_appends_across_blocks(void) {
+  Log log;
+  std::vector<uint8_t> expected;
+  log.device.resize(REGION_FIRST + REGION_BLOCKS);
+  TEST_ASSERT_TRUE(log.format(REGION_FIRST, REGION_BLOCKS));
+
+  for (uint32_t number = 0; number < 200; number++) {
+    std::vector<uint8_t> data = row(number);
+    TEST_ASSERT_EQUAL(data.size(), log.write(&data[0], data.size()));
+    TEST_ASSERT_TRUE(log.sync());
+    expected.insert(expected.end(), data.begin(), data.end());
+  }
+  TEST_ASSERT_EQUAL(expected.size(), log.size());
+  TEST_ASSERT_TRUE(contents(log) == expected);
+
+  Log after;
+  reboot(log, after);
+  TEST_ASSERT_EQUAL(expected.size(), after.size());
+  TEST_ASSERT_TRUE(contents(after) == expected);
+
+  // And carries on where it left off
+  std::vector<uint8_t> data = row(200);
+  after.write(&data[0], data.size());
+  after.sync();
+  expected.insert(expected.end(), data.begin(), data.end());
+  Log again;
+  reboot(after, again);
+  TEST_ASSERT_TRUE(contents(again) == expected);
+}
+
+void test_block_log_stops_when_full(void) {
+  Log log;
+  log.device.resize(REGION_FIRST + 6);
+  TEST_ASSERT_TRUE(log.format(REGION_FIRST, 6));
+
+  std::vector<uint8_t> data(1000, 0x5A);
+  TEST_ASSERT_EQUAL(3 * BLOCK_LOG_PAYLOAD, log.write(&data[0], 1000) + log.write(&data[0], 1000));
+  TEST_ASSERT_EQUAL(0, log.write(&data[0], 1));
+  TEST_ASSERT_TRUE(log.sync());
+
+  Log after;
+  reboot(log, after, 6);
+  TEST_ASSERT_EQUAL(3 * BLOCK_LOG_PAYLOAD, after.size());
+}
+
+// Append latency doesn't grow with the log, and a reset only looks at the tail
+void test_block_log_constant_cost(void) {
+  Log log;
+  log.device.resize(REGION_FIRST + 1024);
+  TEST_ASSERT_TRUE(log.format(REGION_FIRST, 1024));
+
+  uint32_t mostWrites = 0;
+  for (uint32_t number = 0; log.size() < 1000 * BLOCK_LOG_PAYLOAD; number++) {
+    std::vector<uint8_t> data = row(number);
+    uint32_t before = log.device.writes;
+    log.write(&data[0], data.size());
+    TEST_ASSERT_TRUE(log.sync());
+    if (log.device.writes - before > mostWrites) mostWrites = log.device.writes - before;
+  }
+  TEST_ASSERT_LESS_OR_EQUAL(4, mostWrites);
+
+  Log after;
+  after.device.image = log.device.image;
+  TEST_ASSERT_TRUE(after.mount(REGION_FIRST, 1024));
+  TEST_ASSERT_EQUAL(log.size(), after.size());
+  TEST_ASSERT_LESS_OR_EQUAL(6, after.device.reads);
+}
+
+// Cut the power during every single write of a run of appends, with the
+// block torn at different points, and check every time that a reboot gets
+// back at least all synced data, nothing that wasn't written, and can carry on
+void test_block_log_survives_power_cuts(void) {
+  const uint16_t torn[] = { 0, 16, 300, BLOCK_LOG_BLOCK_SIZE };
+  std::vector<uint8_t> stream;
+  for (uint32_t number = 0; number < 60; number++) {
+    std::vector<uint8_t> data = row(number);
+    stream.insert(stream.end(), data.begin(), data.end());
+  }
+
+  for (uint8_t t = 0; t < sizeof(torn) / sizeof(torn[0]); t++) {
+    for (int32_t cut = 0;; cut++) {
+      Log log;
+      log.device.resize(REGION_FIRST + 16);
+      TEST_ASSERT_TRUE(log.format(REGION_FIRST, 16));
+      log.device.cutAt = log.device.writes + cut;
+      log.device.tornBytes = torn[t];
+
+      size_t synced = 0;
+      size_t attempted = 0;
+      for (uint32_t number = 0; number < 60 && log.device.powered; number++) {
+        std::vector<uint8_t> data = row(number);
+        attempted += data.size();
+        if (log.write(&data[0], data.size()) == data.size() && log.sync()) synced = attempted;
+      }
+      if (log.device.powered) break;
+
+      Log after;
+      reboot(log, after, 16);
+      std::vector<uint8_t> recovered = contents(after);
+      TEST_ASSERT_GREATER_OR_EQUAL(synced, recovered.size());
+      TEST_ASSERT_LESS_OR_EQUAL(attempted, recovered.size());
+      TEST_ASSERT_TRUE(std::equal(recovered.begin(), recovered.end(), stream.begin()));
+
+      std::vector<uint8_t> more = row(1000);
+      TEST_ASSERT_EQUAL(more.size(), after.write(&more[0], more.size()));
+      TEST_ASSERT_TRUE(after.sync());
+      recovered.insert(recovered.end(), more.begin(), more.end());
+      Log again;
+      reboot(after, again, 16);
+      TEST_ASSERT_TRUE(contents(again) == recovered);
+    }
+  }
+}
+
+void run_block_log_tests(void) {
+  RUN_TEST(test_block_log_needs_format);
+  RUN_TEST(test_block_log_read_error_is_not_blank);
+  RUN_TEST(test_block_log_appends_across_blocks);
+  RUN_TEST(test_block_log_stops_when_full);
+  RUN_TEST(test_block_log_constant_cost);
+  RUN_TEST(test_block_log_survives_power_cuts);
+}
+
+#endif
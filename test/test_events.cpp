@@ -0,0 +1,135 @@
+#ifdef NATIVE
+
+#include <unity.h>
+#include <math.h>
+#include <string.h>
+#include <events.h>
+#include <fault_detector.h>
+
+// 2021-06-01 12:00:00 in seconds since 2000-01-01
+#define EVENT_TIME 675864000UL
+
+void test_events_encode_exact_bytes(void) {
+  uint8_t record[EVENT_MAX_RECORD];
+  uint8_t length = encodeEvent(record, EV_ZONE_FINISHED, EVENT_TIME, (uint8_t)3, 1.5f);
+  const uint8_t expected[] = {
+    EVENT_MARKER, EV_ZONE_FINISHED,
+    0xC0, 0xDD, 0x48, 0x28,   // time, little endian
+    0x03,                     // plot
+    0x00, 0x00, 0xC0, 0x3F,   // 1.5f
+    0x00                      // checksum, filled in below
+  };
+  uint8_t sum = 0;
+  for (uint8_t i = 1; i < sizeof(expected) - 1; i++) sum += expected[i];
+
+  TEST_ASSERT_EQUAL(sizeof(expected), length);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, record, sizeof(expected) - 1);
+  TEST_ASSERT_EQUAL_UINT8(sum, record[length - 1]);
+  TEST_ASSERT_EQUAL(length, readEvent(record, length));
+}
+
+// Checks that encodeEvent() turned event 'id' into an EV_BAD_EVENT record
+static void assertBadEvent(uint8_t id, const uint8_t *record, uint8_t length) {
+  TEST_ASSERT_EQUAL(EVENT_HEADER + 2, length);
+  TEST_ASSERT_EQUAL(EV_BAD_EVENT, record[1]);
+  TEST_ASSERT_EQUAL(id, record[EVENT_HEADER]);
+  TEST_ASSERT_EQUAL(length, readEvent(record, length));
+}
+
+void test_events_reject_arguments_that_dont_match_the_catalog(void) {
+  uint8_t record[EVENT_MAX_RECORD];
+  // Too few, too many, a float where a plot number belongs, and an int or a
+  // double instead of the exact type
+  assertBadEvent(EV_ZONE_FINISHED, record, encodeEvent(record, EV_ZONE_FINISHED, EVENT_TIME, (uint8_t)3));
+  assertBadEvent(EV_ZONE_STARTED, record, encodeEvent(record, EV_ZONE_STARTED, EVENT_TIME, (uint8_t)3, (uint8_t)4));
+  assertBadEvent(EV_SENSOR_LOW, record, encodeEvent(record, EV_SENSOR_LOW, EVENT_TIME, 0.2f, 0.2f));
+  assertBadEvent(EV_ZONE_STARTED, record, encodeEvent(record, EV_ZONE_STARTED, EVENT_TIME, 3));
+  assertBadEvent(EV_LEAK, record, encodeEvent(record, EV_LEAK, EVENT_TIME, 0.5));
+  // Unknown events
+  assertBadEvent(EV_NONE, record, encodeEvent(record, EV_NONE, EVENT_TIME));
+  assertBadEvent(EV_COUNT, record, encodeEvent(record, EV_COUNT, EVENT_TIME));
+  TEST_ASSERT_EQUAL(EVENT_HEADER + 1, encodeEvent(record, EV_DHT_FAILED, EVENT_TIME));
+}
+
+void test_events_check_arguments_at_compile_time(void) {
+  static_assert(EventArgs<uint8_t, float>::fit(EVENT_SIGNATURES[EV_ZONE_FINISHED]), "plot and liters");
+  static_assert(EventArgs<uint8_t, uint8_t>::fit(EVENT_SIGNATURES[EV_PLOT_DISABLED]), "a fault code is a byte");
+  static_assert(!EventArgs<uint8_t>::fit(EVENT_SIGNATURES[EV_ZONE_FINISHED]), "too few");
+  static_assert(!EventArgs<uint8_t, uint8_t>::fit(EVENT_SIGNATURES[EV_ZONE_STARTED]), "too many");
+  static_assert(!EventArgs<int>::fit(EVENT_SIGNATURES[EV_ZONE_STARTED]), "not the exact type");
+  static_assert(!EventArgs<double>::fit(EVENT_SIGNATURES[EV_LEAK]), "not the exact type");
+  uint8_t checked[EVENT_MAX_RECORD], record[EVENT_MAX_RECORD];
+  uint8_t length = encodeEvent<EV_ZONE_FINISHED>(checked, EVENT_TIME, (uint8_t)3, 1.5f);
+  TEST_ASSERT_EQUAL(encodeEvent(record, EV_ZONE_FINISHED, EVENT_TIME, (uint8_t)3, 1.5f), length);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(record, checked, length);
+}
+
+void test_events_render_the_original_messages(void) {
+  uint8_t record[EVENT_MAX_RECORD];
+  char text[EVENT_MAX_TEXT];
+
+  encodeEvent(record, EV_ZONE_FINISHED, EVENT_TIME, (uint8_t)12, 2.345f);
+  renderEvent(record, text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("Plot 12 irrigation finished. Water delivered: 2.35 L", text);
+
+  encodeEvent(record, EV_SENSOR_LOW, EVENT_TIME, (uint8_t)4, -0.1f);
+  renderEvent(record, text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("WARNING: Sensor 4 out of range (too low). Current reading: -0.10 m3/m3", text);
+
+  encodeEvent(record, EV_PLOT_DISABLED, EVENT_TIME, (uint8_t)2, (uint8_t)FAULT_STEP);
+  renderEvent(record, text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("WARNING: Plot 2 disabled: sudden step in sensor reading", text);
+
+  encodeEvent(record, EV_PLOT_READING, EVENT_TIME, (uint8_t)1, 0.42f, (uint16_t)300, 75.0f);
+  renderEvent(record, text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("Plot #1: VWC 0.42 m3/m3, 300 irrigations, 75.00 L delivered", text);
+
+  // Cut short rather than overflow
+  renderEvent(record, text, 10);
+  TEST_ASSERT_EQUAL_STRING("Plot #1: ", text);
+
+  // Also in the middle of a word
+  memset(text, 'x', sizeof(text));
+  encodeEvent(record, EV_LEAK, EVENT_TIME, NAN);
+  TEST_ASSERT_EQUAL(10, renderEvent(record, text, 11));
+  TEST_ASSERT_EQUAL_STRING("WARNING: n", text);
+  renderEvent(record, text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("WARNING: nan L of water flowed while all valves were closed. Check for a stuck valve or leak.", text);
+}
+
+void test_events_reader_skips_damaged_records(void) {
+  uint8_t stream[3 * EVENT_MAX_RECORD];
+  uint8_t first = encodeEvent(stream, EV_LEAK, EVENT_TIME, 0.75f);
+  uint8_t second = encodeEvent(stream + first, EV_ZONE_STARTED, EVENT_TIME + 1, (uint8_t)5);
+
+  TEST_ASSERT_EQUAL(first, readEvent(stream, first + second));
+  TEST_ASSERT_EQUAL(0, readEvent(stream, first - 1));
+  stream[3] ^= 0x01;
+  TEST_ASSERT_EQUAL(0, readEvent(stream, first + second));
+
+  // Resync on the next marker, the way tools/decode_events.py does
+  uint16_t offset = 1;
+  while (offset < first + second && readEvent(stream + offset, first + second - offset) == 0) offset++;
+  TEST_ASSERT_EQUAL(first, offset);
+  TEST_ASSERT_EQUAL(EV_ZONE_STARTED, stream[offset + 1]);
+}
+
+void test_events_are_much_smaller_than_the_text(void) {
+  uint8_t record[EVENT_MAX_RECORD];
+  char text[EVENT_MAX_TEXT];
+  uint8_t length = encodeEvent(record, EV_ENVIRONMENT, EVENT_TIME, 55.0f, 24.5f, 3.07f, 1.69f, 1.38f);
+  uint8_t textLength = renderEvent(record, text, sizeof(text));
+  TEST_ASSERT_EQUAL(EVENT_HEADER + 5 * 4 + 1, length);
+  TEST_ASSERT_TRUE(length * 2 < textLength);
+}
+
+void run_events_tests(void) {
+  RUN_TEST(test_events_encode_exact_bytes);
+  RUN_TEST(test_events_reject_arguments_that_dont_match_the_catalog);
+  RUN_TEST(test_events_check_arguments_at_compile_time);
+  RUN_TEST(test_events_render_the_original_messages);
+  RUN_TEST(test_events_reader_skips_damaged_records);
+  RUN_TEST(test_events_are_much_smaller_than_the_text);
+}
+
+#endif
@@ -0,0 +1,295 @@
+#ifdef NATIVE
+
+#include <unity.h>
+#include <vector>
+#include <fast_control.h>
+#include <controller.h>
+#include "SimHardware.h"
+#include "TestSetup.h"
+
+struct Edge {
+  uint32_t us;
+  bool open;
+};
+
+// Tick 'fast' every millisecond of virtual time, as the timer interrupt
+// would, and record when 'zone' opens and closes. The interrupt starts
+// 'latency(tick)' microseconds after the timer fires, or not at all
+// for that tick if it returns a negative value (interrupts were off)
+template <class Latency>
+static std::vector<Edge> run(FastControl &fast, uint8_t zone, uint32_t ticks, Latency latency) {
+  std::vector<Edge> edges;
+  bool open = false;
+  for (uint32_t tick = 0; tick < ticks; tick++) {
+    int32_t late = latency(tick);
+    if (late < 0) continue;
+    uint32_t now = 5000000UL + tick * FAST_TICK_US + late;
+    fast.tick(now);
+    bool nowOpen = fast.openZones() & (1 << zone);
+    if (nowOpen != open) {
+      Edge edge = { now, nowOpen };
+      edges.push_back(edge);
+      open = nowOpen;
+    }
+  }
+  return edges;
+}
+
+static int32_t onTime(uint32_t tick) {
+  return 4 + tick * 7 % 37; // 4 - 40 us of interrupt latency
+}
+
+void test_fast_control_rejects_timing_it_cant_do(void) {
+  FastControl fast;
+  TEST_ASSERT_FALSE(fast.setZone(3, 5, 2));    // 200 Hz
+  TEST_ASSERT_FALSE(fast.setZone(3, 200, 20)); // 5 Hz
+  TEST_ASSERT_FALSE(fast.setZone(3, 50, 50));
+  TEST_ASSERT_FALSE(fast.setZone(3, 50, 0));
+  TEST_ASSERT_FALSE(fast.setZone(0, 50, 10));
+  TEST_ASSERT_FALSE(fast.setZone(15, 50, 10));
+  TEST_ASSERT_EQUAL(0, fast.zones());
+  TEST_ASSERT_TRUE(fast.setZone(3, 50, 10));
+  TEST_ASSERT_EQUAL(1 << 3, fast.zones());
+}
+
+void test_fast_control_keeps_millisecond_timing(void) {
+  FastControl fast;
+  fast.setZone(3, 50, 10); // 20 Hz
+  fast.setZone(5, 10, 3);  // 100 Hz
+  fast.start();
+  std::vector<Edge> edges = run(fast, 3, 1000, onTime);
+
+  // 20 cycles in a second, each open for 10 ms every 50 ms
+  TEST_ASSERT_EQUAL(40, edges.size());
+  for (size_t n = 0; n + 1 < edges.size(); n += 2) {
+    TEST_ASSERT_TRUE(edges[n].open);
+    TEST_ASSERT_FALSE(edges[n + 1].open);
+    TEST_ASSERT_INT_WITHIN(40, 10000, edges[n + 1].us - edges[n].us);
+    if (n >= 2) TEST_ASSERT_INT_WITHIN(40, 50000, edges[n].us - edges[n - 2].us);
+  }
+
+  FastStats stats;
+  fast.stats(stats);
+  TEST_ASSERT_EQUAL(40 + 200, stats.switches);
+  TEST_ASSERT_EQUAL(stats.switches, stats.onTime);
+  TEST_ASSERT_EQUAL(0, stats.missed);
+  TEST_ASSERT_TRUE(stats.maxLateUs <= 36);
+  TEST_ASSERT_TRUE(stats.maxLateUs > 0);
+}
+
+// Interrupts held off for 25 ms from 100 ms in, and one tick that runs a
+// whole millisecond late
+static int32_t stalled(uint32_t tick) {
+  if (tick >= 100 && tick < 125) return -1;
+  if (tick == 160) return FAST_TICK_US;
+  return tick % 4 * 5;
+}
+
+void test_fast_control_counts_missed_deadlines_and_stays_in_phase(void) {
+  FastControl fast;
+  fast.setZone(3, 20, 5);
+  fast.start();
+  std::vector<Edge> edges = run(fast, 3, 400, stalled);
+
+  FastStats stats;
+  fast.stats(stats);
+  // The first tick after the stall (125 ms) skips the cycle at 100 ms, and
+  // the pulse at 120 ms too as it is already due to close (2 edges each).
+  // The open at 160 ms is a tick late
+  TEST_ASSERT_EQUAL(2 + 2 + 1, stats.missed);
+  TEST_ASSERT_EQUAL(18 * 2, stats.switches); // 20 cycles, 2 skipped
+  TEST_ASSERT_EQUAL(stats.switches - 1, stats.onTime);
+  TEST_ASSERT_EQUAL(5, stats.maxLateUs);
+
+  // The relay stays closed from the close at 85 ms until 140 ms
+  for (size_t n = 0; n < edges.size(); n++) {
+    if (edges[n].us <= 5000000UL + 85010UL) continue;
+    TEST_ASSERT_TRUE(edges[n].open);
+    TEST_ASSERT_EQUAL(5000000UL + 140000UL, edges[n].us);
+    break;
+  }
+
+  // Every open after that is back on the 20 ms grid
+  uint8_t opens = 0;
+  for (size_t n = 0; n < edges.size(); n++) {
+    if (!edges[n].open || edges[n].us < 5000000UL + 170000UL) continue;
+    TEST_ASSERT_EQUAL(0, (edges[n].us - 5000000UL) % 20000);
+    opens++;
+  }
+  TEST_ASSERT_EQUAL(11, opens); // 180 - 380 ms
+}
+
+void test_fast_control_stop_closes_every_zone(void) {
+  FastControl fast;
+  fast.setZone(2, 100, 60);
+  fast.setZone(4, 100, 60);
+  fast.start();
+  TEST_ASSERT_TRUE(fast.tick(1000));
+  TEST_ASSERT_EQUAL(1 << 2 | 1 << 4, fast.openZones());
+  fast.stop();
+  TEST_ASSERT_TRUE(fast.tick(2000));
+  TEST_ASSERT_EQUAL(0, fast.openZones());
+  TEST_ASSERT_FALSE(fast.tick(3000));
+}
+
+// A slow plot on its threshold and a 50 Hz mist zone, with the timer
+// interrupt running on the controller's virtual clock
+void test_fast_control_runs_next_to_the_schedule(void) {
+  Controller<SimHardware> controller;
+  SimHardware &sim = controller.hardware;
+  sim.start = MONDAY;
+  sim.moisture[1] = 250;
+  sim.moisture[2] = 250;
+  setupPlots(controller.irrigation, 2);
+  controller.irrigation.fast.setZone(2, 20, 4);
+
+  uint32_t opens = 0;
+  bool wasOpen = false;
+  sim.onSleep = [&](uint16_t ms) {
+    for (uint16_t n = 0; n < ms; n++) {
+      controller.fastTick((uint32_t)(sim.elapsedMs - ms + n + 1) * 1000 + 12);
+      bool open = sim.relayOn(CONTROLLER_RELAY_PIN(2));
+      if (open && !wasOpen) opens++;
+      wasOpen = open;
+    }
+  };
+  controller.begin();
+  controller.irrigation.fast.start();
+
+  // Plot 2 is dry too, but only plot 1 goes on the schedule
+  ScheduleEvent event;
+  while (controller.step(event)) TEST_ASSERT_NOT_EQUAL(2, event.zone);
+  TEST_ASSERT_FALSE(controller.irrigation.schedule.isPending(2));
+  while (sim.now() < MONDAY + 120) {
+    while (controller.step(event)) TEST_ASSERT_NOT_EQUAL(2, event.zone);
+    controller.idle();
+  }
+  TEST_ASSERT_EQUAL(1, controller.irrigation.counter(1));
+  TEST_ASSERT_EQUAL(0, controller.irrigation.counter(2));
+
+  // 50 pulses a second for as long as the virtual clock ran
+  TEST_ASSERT_INT_WITHIN(1, sim.elapsedMs / 20, opens);
+  FastStats stats;
+  controller.irrigation.fast.stats(stats);
+  TEST_ASSERT_EQUAL(0, stats.missed);
+  TEST_ASSERT_EQUAL(stats.switches, stats.onTime);
+}
+
+// A blackout for the first minute, then plot 2 reads a step in its sensor
+// from 120 s on and is disabled once it stays there. Its mist zone only runs
+// in between
+void test_fast_control_holds_zones_through_blackouts_and_faults(void) {
+  Controller<SimHardware> controller;
+  SimHardware &sim = controller.hardware;
+  sim.start = MONDAY;
+  sim.moisture[1] = 400;
+  sim.moisture[2] = 400;
+  setupPlots(controller.irrigation, 2, 30, 60, 60);
+  controller.irrigation.schedule.addBlackoutWindow(0, 1);
+  controller.irrigation.fast.setZone(2, 20, 4);
+
+  uint32_t opens = 0;
+  uint32_t firstOpen = 0;
+  uint32_t lastOpen = 0;
+  bool wasOpen = false;
+  sim.onSleep = [&](uint16_t ms) {
+    for (uint16_t n = 0; n < ms; n++) {
+      uint32_t at = sim.elapsedMs - ms + n + 1;
+      controller.fastTick(at * 1000 + 12);
+      bool open = sim.relayOn(CONTROLLER_RELAY_PIN(2));
+      if (open && !wasOpen) {
+        if (!opens) firstOpen = at;
+        lastOpen = at;
+        opens++;
+      }
+      wasOpen = open;
+    }
+  };
+  controller.begin();
+  controller.irrigation.fast.start();
+
+  ScheduleEvent event;
+  while (sim.now() < MONDAY + 240) {
+    while (controller.step(event)) {}
+    if (sim.now() >= MONDAY + 60) sim.moisture[2] = 50;
+    controller.idle();
+  }
+
+  // Released at the end of the blackout, held again once the step trips
+  TEST_ASSERT_EQUAL(FAULT_STEP, controller.irrigation.faults.fault(2));
+  TEST_ASSERT_TRUE(controller.irrigation.fast.isHeld(2));
+  TEST_ASSERT_INT_WITHIN(20, 60000, firstOpen);
+  TEST_ASSERT_INT_WITHIN(50, 180000, lastOpen); // the sensors warm up first
+  TEST_ASSERT_INT_WITHIN(3, 120000 / 20, opens);
+  TEST_ASSERT_FALSE(sim.relayOn(CONTROLLER_RELAY_PIN(2)));
+  FastStats stats;
+  controller.irrigation.fast.stats(stats);
+  TEST_ASSERT_EQUAL(0, stats.missed);
+}
+
+// Plot 1 on its threshold with a 2 L flow cutoff next to a 50 Hz mist zone
+// on plot 2 that is metered on 'mistMeter'. Each mist pulse is one meter
+// pulse, plot 1 gets 5 a second (100 pulses a liter). Returns how long
+// plot 1's valve stayed open and what the mist meter booked as a leak
+static uint32_t runMetered(uint8_t mistMeter, float &leak) {
+  Controller<SimHardware> controller;
+  SimHardware &sim = controller.hardware;
+  Irrigation &irrigation = controller.irrigation;
+  sim.start = MONDAY;
+  sim.moisture[1] = 250;
+  sim.moisture[2] = 250;
+  setupPlots(irrigation, 2);
+  irrigation.flow.setPulsesPerLiter(0, 100);
+  irrigation.flow.setPulsesPerLiter(1, 100);
+  irrigation.flow.setZoneMeter(2, mistMeter);
+  irrigation.flow.setTargetVolume(1, 2.0);
+  irrigation.fast.setZone(2, 20, 4);
+
+  bool wasOpen = false;
+  sim.onSleep = [&](uint16_t ms) {
+    for (uint16_t n = 0; n < ms; n++) {
+      uint32_t at = sim.elapsedMs - ms + n + 1;
+      controller.fastTick(at * 1000 + 12);
+      bool open = sim.relayOn(CONTROLLER_RELAY_PIN(2));
+      if (open && !wasOpen) irrigation.flow.pulse(mistMeter);
+      wasOpen = open;
+      if (sim.watering(1) && at % 200 == 0) irrigation.flow.pulse(0);
+    }
+  };
+  controller.begin();
+  irrigation.fast.start();
+
+  uint32_t opened = 0, closed = 0;
+  ScheduleEvent event;
+  while (sim.now() < MONDAY + 600) {
+    while (controller.step(event)) {
+      if (event.type == EVENT_ZONE_OPEN) opened = event.at;
+      if (event.type == EVENT_ZONE_CLOSE) closed = event.at;
+    }
+    controller.idle();
+  }
+  leak = irrigation.flow.takeUnattributed(mistMeter);
+  return closed - opened;
+}
+
+// The mist is neither a leak nor water for plot 1. On plot 1's meter it
+// takes the flow cutoff out of play, on a meter of its own it doesn't
+void test_fast_control_water_is_kept_out_of_the_flow_meter(void) {
+  float leak;
+  TEST_ASSERT_EQUAL(60, runMetered(0, leak));
+  TEST_ASSERT_EQUAL(0, leak);
+  TEST_ASSERT_INT_WITHIN(1, 40, runMetered(1, leak));
+  TEST_ASSERT_EQUAL(0, leak);
+}
+
+void run_fast_control_tests(void) {
+  RUN_TEST(test_fast_control_rejects_timing_it_cant_do);
+  RUN_TEST(test_fast_control_keeps_millisecond_timing);
+  RUN_TEST(test_fast_control_counts_missed_deadlines_and_stays_in_phase);
+  RUN_TEST(test_fast_control_stop_closes_every_zone);
+  RUN_TEST(test_fast_control_runs_next_to_the_schedule);
+  RUN_TEST(test_fast_control_holds_zones_through_blackouts_and_faults);
+  RUN_TEST(test_fast_control_water_is_kept_out_of_the_flow_meter);
+}
+
+#endif
@@ -0,0 +1,207 @@
+#ifdef NATIVE
+
+#include <unity.h>
+#include <string.h>
+#include <fault_detector.h>
+#include <irrigation.h>
+#include "TestSetup.h"
+
+// Readings every 30 minutes, so 48 a day
+#define DAY_OF_SAMPLES 48
+
+static uint32_t noiseState;
+
+// About one ADC count of noise on the 10HS reading
+static float noise(void) {
+  noiseState = noiseState * 1103515245 + 12345;
+  return ((int)((noiseState >> 16) % 7) - 3) * 0.001;
+}
+
+// A healthy bed drying out during the day and getting irrigated whenever it
+// drops below the threshold. Returns the first fault that was reported
+static uint8_t simulateHealthyBed(FaultDetector &faults, uint8_t zone, uint16_t samples, uint8_t *irrigations) {
+  float vwc = 0.4;
+  bool watered = false;
+  *irrigations = 0;
+  noiseState = 1;
+  for (uint16_t n = 0; n < samples; n++) {
+    if (watered) vwc += 0.12;
+    vwc -= (n % DAY_OF_SAMPLES) < DAY_OF_SAMPLES / 2 ? 0.006 : 0.001;
+    uint8_t fault = faults.update(zone, vwc + noise());
+    if (fault != FAULT_NONE) return fault;
+    watered = vwc < 0.3;
+    if (watered) {
+      faults.irrigated(zone);
+      (*irrigations)++;
+    }
+  }
+  return FAULT_NONE;
+}
+
+void test_fault_detector_accepts_two_weeks_of_healthy_bed(void) {
+  FaultDetector faults;
+  uint8_t irrigations;
+
+  TEST_ASSERT_EQUAL(FAULT_NONE, simulateHealthyBed(faults, 1, 14 * DAY_OF_SAMPLES, &irrigations));
+  TEST_ASSERT_GREATER_THAN(5, irrigations);
+  TEST_ASSERT_FALSE(faults.isDisabled(1));
+}
+
+void test_fault_detector_flags_flatlined_sensor(void) {
+  FaultDetector faults;
+  uint16_t n;
+
+  for (n = 0; n < 2 * DAY_OF_SAMPLES; n++) {
+    if (faults.update(2, 0.35) != FAULT_NONE) break;
+  }
+
+  TEST_ASSERT_EQUAL(FAULT_FLATLINE, faults.fault(2));
+  TEST_ASSERT_LESS_THAN(DAY_OF_SAMPLES + 2, n);
+  TEST_ASSERT_TRUE(faults.isDisabled(2));
+  TEST_ASSERT_FALSE(faults.isDisabled(3));
+}
+
+void test_fault_detector_flags_valve_that_never_wets_the_bed(void) {
+  FaultDetector faults;
+  float vwc = 0.32;
+  uint8_t irrigations = 0;
+  uint8_t fault = FAULT_NONE;
+
+  noiseState = 7;
+  for (uint16_t n = 0; n < DAY_OF_SAMPLES && fault == FAULT_NONE; n++) {
+    vwc -= 0.003;
+    fault = faults.update(4, vwc + noise());
+    if (vwc < 0.3 && !faults.isDisabled(4)) {
+      faults.irrigated(4);
+      irrigations++;
+    }
+  }
+
+  // The bed is irrigated after every reading, and each irrigation gets two
+  // readings to show up, so three misses take six irrigations
+  TEST_ASSERT_EQUAL(FAULT_NO_RESPONSE, fault);
+  TEST_ASSERT_EQUAL(6, irrigations);
+}
+
+void test_fault_detector_ignores_single_glitch(void) {
+  FaultDetector faults;
+  faults.update(5, 0.40);
+  faults.update(5, 0.39);
+
+  TEST_ASSERT_EQUAL(FAULT_NONE, faults.update(5, 0.05));
+  TEST_ASSERT_EQUAL(FAULT_NONE, faults.update(5, 0.38));
+  TEST_ASSERT_EQUAL(FAULT_NONE, faults.update(5, 0.37));
+  TEST_ASSERT_FALSE(faults.isDisabled(5));
+}
+
+void test_fault_detector_flags_step_that_stays(void) {
+  FaultDetector faults;
+  faults.update(6, 0.40);
+  faults.update(6, 0.39);
+
+  // Sensor pulled out of the substrate
+  TEST_ASSERT_EQUAL(FAULT_NONE, faults.update(6, 0.05));
+  TEST_ASSERT_EQUAL(FAULT_STEP, faults.update(6, 0.05));
+  TEST_ASSERT_TRUE(faults.isDisabled(6));
+
+  // Only the first fault is reported, until the zone is cleared
+  TEST_ASSERT_EQUAL(FAULT_NONE, faults.update(6, 0.40));
+  faults.clear(6);
+  TEST_ASSERT_FALSE(faults.isDisabled(6));
+}
+
+void test_fault_detector_allows_jump_after_irrigation(void) {
+  FaultDetector faults;
+  faults.update(7, 0.28);
+  faults.irrigated(7);
+
+  TEST_ASSERT_EQUAL(FAULT_NONE, faults.update(7, 0.46));
+  TEST_ASSERT_EQUAL(FAULT_NONE, faults.update(7, 0.45));
+  TEST_ASSERT_FALSE(faults.isDisabled(7));
+}
+
+// The detector as Irrigation sets it up, fed the sketch's whole number VWC
+// (analogRead() / 10). Plot 1 dries out by day and gets irrigated below 30,
+// plot 2 (wet) sits on the same reading until its sensor is stuck for days
+void test_fault_detector_defaults_fit_the_sketch_scale(void) {
+  Irrigation irrigation;
+  setupPlots(irrigation, 2);
+  float raw = 340;
+  bool open = false;
+  noiseState = 3;
+
+  ScheduleEvent event;
+  uint32_t now = MONDAY;
+  irrigation.begin(now);
+  for (; now < MONDAY + 4 * SCHEDULE_SECONDS_PER_DAY; now += 10) {
+    if (now == MONDAY + 2 * SCHEDULE_SECONDS_PER_DAY) {
+      TEST_ASSERT_FALSE(irrigation.faults.isDisabled(1));
+      TEST_ASSERT_FALSE(irrigation.faults.isDisabled(2));
+      TEST_ASSERT_GREATER_THAN(2, irrigation.counter(1));
+    }
+    while (irrigation.poll(now, event)) {
+      if (event.type == EVENT_ZONE_OPEN || event.type == EVENT_ZONE_CLOSE) open = event.type == EVENT_ZONE_OPEN;
+      if (event.type != EVENT_SAMPLE) continue;
+      RawInputs inputs;
+      memset(&inputs, 0, sizeof(inputs));
+      inputs.at = now;
+      inputs.sensorValue[1] = raw + noise() * 1000;
+      inputs.sensorValue[2] = 380;
+      irrigation.sample(inputs);
+    }
+    bool day = (now - MONDAY) % SCHEDULE_SECONDS_PER_DAY < SCHEDULE_SECONDS_PER_DAY / 2;
+    raw -= day ? 0.05 : 0.0056;
+    if (open) raw += 20;
+  }
+
+  TEST_ASSERT_FALSE(irrigation.faults.isDisabled(1));
+  TEST_ASSERT_EQUAL(FAULT_FLATLINE, irrigation.faults.fault(2));
+}
+
+// Plot 1 asks for water during the 11:00 - 15:00 blackout, then its sensor
+// steps up at 13:00 and is disabled at 13:30. The irrigation waiting for the
+// end of the blackout is dropped, master valve and all
+void test_fault_detector_cancels_irrigation_waiting_out_a_blackout(void) {
+  Irrigation irrigation;
+  setupPlots(irrigation, 1);
+  irrigation.schedule.addBlackoutWindow(11 * 60, 15 * 60);
+  irrigation.schedule.setMasterDelay(5);
+
+  uint8_t opens = 0, masterOpens = 0;
+  ScheduleEvent event;
+  uint32_t now = MONDAY + 11 * 3600UL;
+  irrigation.begin(now);
+  while (now < MONDAY + 16 * 3600UL) {
+    while (irrigation.poll(now, event)) {
+      if (event.type == EVENT_ZONE_OPEN) opens++;
+      if (event.type == EVENT_MASTER_OPEN) masterOpens++;
+      if (event.type != EVENT_SAMPLE) continue;
+      RawInputs inputs;
+      memset(&inputs, 0, sizeof(inputs));
+      inputs.at = now;
+      inputs.sensorValue[1] = now < MONDAY + 13 * 3600UL ? 250 : 900;
+      irrigation.sample(inputs);
+      if (now == MONDAY + 11 * 3600UL) TEST_ASSERT_TRUE(irrigation.schedule.isPending(1));
+    }
+    now = irrigation.schedule.nextDue();
+  }
+
+  TEST_ASSERT_EQUAL(FAULT_STEP, irrigation.faults.fault(1));
+  TEST_ASSERT_EQUAL(0, opens);
+  TEST_ASSERT_EQUAL(0, masterOpens);
+  TEST_ASSERT_EQUAL(0, irrigation.counter(1));
+  TEST_ASSERT_FALSE(irrigation.schedule.isPending(1));
+}
+
+void run_fault_detector_tests(void) {
+  RUN_TEST(test_fault_detector_accepts_two_weeks_of_healthy_bed);
+  RUN_TEST(test_fault_detector_flags_flatlined_sensor);
+  RUN_TEST(test_fault_detector_flags_valve_that_never_wets_the_bed);
+  RUN_TEST(test_fault_detector_ignores_single_glitch);
+  RUN_TEST(test_fault_detector_flags_step_that_stays);
+  RUN_TEST(test_fault_detector_allows_jump_after_irrigation);
+  RUN_TEST(test_fault_detector_defaults_fit_the_sketch_scale);
+  RUN_TEST(test_fault_detector_cancels_irrigation_waiting_out_a_blackout);
+}
+
+#endif
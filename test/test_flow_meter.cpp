@@ -0,0 +1,112 @@
+#ifdef NATIVE
+
+#include <unity.h>
+#include <ring_buffer.h>
+#include <flow_meter.h>
+
+#define ZONE(n) (1 << (n))
+
+void test_ring_buffer_keeps_order_across_wrap(void) {
+  RingBuffer<uint8_t, 8> buffer;
+  uint8_t value;
+
+  for (uint8_t round = 0; round < 5; round++) {
+    for (uint8_t n = 0; n < 5; n++) TEST_ASSERT_TRUE(buffer.push(round * 10 + n));
+    TEST_ASSERT_EQUAL(5, buffer.count());
+    for (uint8_t n = 0; n < 5; n++) {
+      TEST_ASSERT_TRUE(buffer.pop(value));
+      TEST_ASSERT_EQUAL(round * 10 + n, value);
+    }
+    TEST_ASSERT_TRUE(buffer.isEmpty());
+  }
+  TEST_ASSERT_FALSE(buffer.pop(value));
+}
+
+void test_ring_buffer_rejects_push_when_full(void) {
+  RingBuffer<uint8_t, 4> buffer;
+
+  TEST_ASSERT_TRUE(buffer.push(1));
+  TEST_ASSERT_TRUE(buffer.push(2));
+  TEST_ASSERT_TRUE(buffer.push(3));
+  TEST_ASSERT_FALSE(buffer.push(4));
+  TEST_ASSERT_EQUAL(3, buffer.count());
+}
+
+void test_flow_meter_credits_open_zone(void) {
+  FlowMeter flow;
+  flow.setPulsesPerLiter(0, 100);
+
+  for (uint16_t n = 0; n < 50; n++) flow.pulse(0);
+  flow.update(ZONE(3));
+
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0.5, flow.liters(3));
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0.5, flow.runLiters(3));
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0.0, flow.liters(4));
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0.0, flow.takeUnattributed(0));
+}
+
+void test_flow_meter_splits_between_zones_on_same_line(void) {
+  FlowMeter flow;
+  flow.setPulsesPerLiter(0, 100);
+  flow.setPulsesPerLiter(1, 10);
+  flow.setZoneMeter(5, 1);
+
+  for (uint16_t n = 0; n < 40; n++) flow.pulse(0);
+  for (uint16_t n = 0; n < 10; n++) flow.pulse(1);
+  flow.update(ZONE(1) | ZONE(2) | ZONE(5));
+
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0.2, flow.liters(1));
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0.2, flow.liters(2));
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 1.0, flow.liters(5));
+}
+
+void test_flow_meter_counts_flow_with_all_valves_closed(void) {
+  FlowMeter flow;
+  flow.setPulsesPerLiter(0, 10);
+
+  for (uint16_t n = 0; n < 25; n++) flow.pulse(0);
+  flow.update(0);
+
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 2.5, flow.takeUnattributed(0));
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0.0, flow.takeUnattributed(0));
+}
+
+void test_flow_meter_keeps_pulses_that_overflow_the_buffer(void) {
+  FlowMeter flow;
+  flow.setPulsesPerLiter(0, 100);
+
+  // Four times what the buffer holds, as if the loop was held up
+  for (uint16_t n = 0; n < 4 * FLOW_BUFFER_SIZE; n++) flow.pulse(0);
+  flow.update(ZONE(1));
+
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 4 * FLOW_BUFFER_SIZE / 100.0, flow.liters(1));
+}
+
+void test_flow_meter_reports_target_volume_reached(void) {
+  FlowMeter flow;
+  flow.setPulsesPerLiter(0, 10);
+  flow.setTargetVolume(2, 1.5);
+  flow.startRun(2);
+
+  for (uint16_t n = 0; n < 10; n++) flow.pulse(0);
+  TEST_ASSERT_EQUAL(0, flow.update(ZONE(2)));
+  for (uint16_t n = 0; n < 5; n++) flow.pulse(0);
+  TEST_ASSERT_EQUAL(ZONE(2), flow.update(ZONE(2)));
+
+  // A new run starts from zero while the total keeps counting
+  flow.startRun(2);
+  TEST_ASSERT_EQUAL(0, flow.update(ZONE(2)));
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 1.5, flow.liters(2));
+}
+
+void run_flow_meter_tests(void) {
+  RUN_TEST(test_ring_buffer_keeps_order_across_wrap);
+  RUN_TEST(test_ring_buffer_rejects_push_when_full);
+  RUN_TEST(test_flow_meter_credits_open_zone);
+  RUN_TEST(test_flow_meter_splits_between_zones_on_same_line);
+  RUN_TEST(test_flow_meter_counts_flow_with_all_valves_closed);
+  RUN_TEST(test_flow_meter_keeps_pulses_that_overflow_the_buffer);
+  RUN_TEST(test_flow_meter_reports_target_volume_reached);
+}
+
+#endif
@@ -13,6 +13,17 @@
 
 using namespace fakeit;
 
+void run_schedule_tests(void);
+void run_flow_meter_tests(void);
+void run_fault_detector_tests(void);
+void run_replay_tests(void);
+void run_controller_tests(void);
+void run_block_log_tests(void);
+void run_events_tests(void);
+void run_sweep_tests(void);
+void run_relay_driver_tests(void);
+void run_fast_control_tests(void);
+
 void test_setup(void)
 {
     When(Method(ArduinoFake(), pinMode)).Return();
@@ -62,6 +73,16 @@ int main(int argc, char **argv) {
     UNITY_BEGIN();    // IMPORTANT LINE!
     RUN_TEST(test_example);
     RUN_TEST(test_relay_pins_are_set_to_high_at_boot);
+    run_schedule_tests();
+    run_flow_meter_tests();
+    run_fault_detector_tests();
+    run_replay_tests();
+    run_controller_tests();
+    run_block_log_tests();
+    run_events_tests();
+    run_sweep_tests();
+    run_relay_driver_tests();
+    run_fast_control_tests();
     UNITY_END();      // stop unit testing
 }
 
@@ -0,0 +1,189 @@
+#ifdef NATIVE
+
+#include <unity.h>
+#include <relay_driver.h>
+#include <controller.h>
+#include "SimHardware.h"
+#include "TestSetup.h"
+
+// PORTA/PORTC and DDRA/DDRC in memory, counting the stores to each port
+class FakePorts {
+public:
+  FakePorts() {
+    for (uint8_t n = 0; n < 2; n++) {
+      port[n] = 0;
+      ddr[n] = 0;
+      stores[n] = 0;
+    }
+  }
+  uint8_t read(uint8_t which) { return port[which]; }
+  void write(uint8_t which, uint8_t value) {
+    port[which] = value;
+    stores[which]++;
+  }
+  void output(uint8_t which, uint8_t bits) { ddr[which] |= bits; }
+
+  uint8_t port[2];
+  uint8_t ddr[2];
+  uint32_t stores[2];
+};
+
+// Where the Mega 2560 has digital pins 22 - 37, from its pin mapping table
+static const uint8_t PIN_PORT[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1 };
+static const uint8_t PIN_BIT[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 7, 6, 5, 4, 3, 2, 1, 0 };
+
+static bool pinHigh(const FakePorts &ports, uint8_t pin) {
+  return ports.port[PIN_PORT[pin - 22]] & (1 << PIN_BIT[pin - 22]);
+}
+
+static bool pinOutput(const FakePorts &ports, uint8_t pin) {
+  return ports.ddr[PIN_PORT[pin - 22]] & (1 << PIN_BIT[pin - 22]);
+}
+
+void test_relay_driver_begin_closes_every_relay(void) {
+  RelayDriver<FakePorts> relays;
+  relays.ports.port[RELAY_PORT_C] = 0x01; // pin 37 isn't a relay
+  relays.begin();
+
+  for (uint8_t pin = RELAY_FIRST_PIN; pin <= RELAY_LAST_PIN; pin++) {
+    TEST_ASSERT_TRUE(pinHigh(relays.ports, pin));
+    TEST_ASSERT_TRUE(pinOutput(relays.ports, pin));
+  }
+  TEST_ASSERT_TRUE(pinHigh(relays.ports, 37));
+  TEST_ASSERT_FALSE(pinOutput(relays.ports, 37));
+  TEST_ASSERT_EQUAL(0, relays.mask());
+}
+
+void test_relay_driver_switches_a_group_with_one_store_per_port(void) {
+  RelayDriver<FakePorts> relays;
+  relays.begin();
+  uint32_t storesA = relays.ports.stores[RELAY_PORT_A];
+  uint32_t storesC = relays.ports.stores[RELAY_PORT_C];
+
+  // Plots 1, 8, 9 and 14 and the master valve
+  relays.set(22, true);
+  relays.set(29, true);
+  relays.set(30, true);
+  relays.set(35, true);
+  relays.set(36, true);
+  relays.set(37, true);
+  // Only staged so far
+  TEST_ASSERT_TRUE(pinHigh(relays.ports, 22));
+  TEST_ASSERT_EQUAL(storesA, relays.ports.stores[RELAY_PORT_A]);
+
+  relays.apply();
+  TEST_ASSERT_EQUAL(storesA + 1, relays.ports.stores[RELAY_PORT_A]);
+  TEST_ASSERT_EQUAL(storesC + 1, relays.ports.stores[RELAY_PORT_C]);
+  TEST_ASSERT_EQUAL(1 << 1 | 1 << 8 | 1 << 9 | 1 << 14 | 1 << 15, relays.mask());
+  for (uint8_t pin = RELAY_FIRST_PIN; pin <= RELAY_LAST_PIN; pin++) {
+    bool open = pin == 22 || pin == 29 || pin == 30 || pin == 35 || pin == 36;
+    TEST_ASSERT_EQUAL(open, relays.isOpen(pin));
+    TEST_ASSERT_EQUAL(!open, pinHigh(relays.ports, pin));
+  }
+  // set(37) is ignored, it isn't a relay
+  TEST_ASSERT_FALSE(pinHigh(relays.ports, 37));
+  TEST_ASSERT_FALSE(relays.isOpen(37));
+
+  relays.set(29, false);
+  relays.set(30, false);
+  relays.apply();
+  TEST_ASSERT_EQUAL(1 << 1 | 1 << 14 | 1 << 15, relays.mask());
+  TEST_ASSERT_TRUE(pinHigh(relays.ports, 29));
+  TEST_ASSERT_TRUE(pinHigh(relays.ports, 30));
+  TEST_ASSERT_FALSE(pinHigh(relays.ports, 22));
+}
+
+void test_relay_driver_mask_matches_pins(void) {
+  RelayDriver<FakePorts> relays;
+  relays.begin();
+  for (uint32_t mask = 0; mask < 0x10000; mask += 2) {
+    relays.setMask(mask);
+    relays.apply();
+    TEST_ASSERT_EQUAL(mask, relays.mask());
+    for (uint8_t pin = RELAY_FIRST_PIN; pin <= RELAY_LAST_PIN; pin++) {
+      TEST_ASSERT_EQUAL(!(mask & (1 << RELAY_MASK_BIT(pin))), pinHigh(relays.ports, pin));
+    }
+  }
+}
+
+void test_relay_driver_applies_only_the_zones_asked_for(void) {
+  RelayDriver<FakePorts> relays;
+  relays.begin();
+  // The main loop has plot 2 staged when the interrupt switches plot 10
+  relays.set(23, true);
+  uint32_t storesA = relays.ports.stores[RELAY_PORT_A];
+  relays.setMasked(1 << 10 | 1 << 3, 1 << 10);
+  relays.apply(1 << 10 | 1 << 3);
+  TEST_ASSERT_FALSE(pinHigh(relays.ports, 31));
+  TEST_ASSERT_TRUE(pinHigh(relays.ports, 23));
+  TEST_ASSERT_TRUE(pinHigh(relays.ports, 24));
+  TEST_ASSERT_EQUAL(1 << 2 | 1 << 10, relays.mask());
+
+  // Only PORTC has one of plots 9 - 14
+  relays.apply(1 << 10);
+  TEST_ASSERT_EQUAL(storesA + 1, relays.ports.stores[RELAY_PORT_A]);
+  relays.apply();
+  TEST_ASSERT_FALSE(pinHigh(relays.ports, 23));
+}
+
+// SimHardware with the relays going through a RelayDriver, like MegaHardware
+class RelayHardware : public SimHardware {
+public:
+  void outputPin(uint8_t pin) {
+    if (RelayDriver<FakePorts>::isRelay(pin)) relays.output(pin);
+    else SimHardware::outputPin(pin);
+  }
+  void writePin(uint8_t pin, bool high) {
+    if (RelayDriver<FakePorts>::isRelay(pin)) relays.set(pin, !high);
+    else SimHardware::writePin(pin, high);
+  }
+  void commitPins() { relays.apply(); }
+
+  RelayDriver<FakePorts> relays;
+};
+
+void test_relay_driver_switches_zones_together_in_controller(void) {
+  Controller<RelayHardware> controller;
+  RelayHardware &hardware = controller.hardware;
+  hardware.start = MONDAY;
+  hardware.moisture[1] = 250;
+  hardware.moisture[2] = 250;
+  setupPlots(controller.irrigation, 2);
+  controller.begin();
+  for (uint8_t pin = RELAY_FIRST_PIN; pin <= RELAY_LAST_PIN; pin++) {
+    TEST_ASSERT_TRUE(pinHigh(hardware.relays.ports, pin));
+    TEST_ASSERT_TRUE(pinOutput(hardware.relays.ports, pin));
+  }
+
+  // Readings, the master valve and plot 1 all open in one go
+  ScheduleEvent event;
+  while (controller.step(event)) {}
+  TEST_ASSERT_EQUAL(1 << 1 | 1 << 15, hardware.relays.mask());
+  TEST_ASSERT_FALSE(pinHigh(hardware.relays.ports, 22));
+  TEST_ASSERT_FALSE(pinHigh(hardware.relays.ports, 36));
+  controller.idle();
+
+  // Plot 1 closing and plot 2 opening are the same store to PORTA
+  uint32_t stores = hardware.relays.ports.stores[RELAY_PORT_A];
+  uint8_t events = 0;
+  while (controller.step(event)) {
+    events++;
+    TEST_ASSERT_FALSE(pinHigh(hardware.relays.ports, 22));
+    TEST_ASSERT_TRUE(pinHigh(hardware.relays.ports, 23));
+  }
+  TEST_ASSERT_EQUAL(2, events);
+  TEST_ASSERT_EQUAL(stores + 1, hardware.relays.ports.stores[RELAY_PORT_A]);
+  TEST_ASSERT_TRUE(pinHigh(hardware.relays.ports, 22));
+  TEST_ASSERT_FALSE(pinHigh(hardware.relays.ports, 23));
+  TEST_ASSERT_EQUAL(1 << 2 | 1 << 15, hardware.relays.mask());
+}
+
+void run_relay_driver_tests(void) {
+  RUN_TEST(test_relay_driver_begin_closes_every_relay);
+  RUN_TEST(test_relay_driver_switches_a_group_with_one_store_per_port);
+  RUN_TEST(test_relay_driver_mask_matches_pins);
+  RUN_TEST(test_relay_driver_applies_only_the_zones_asked_for);
+  RUN_TEST(test_relay_driver_switches_zones_together_in_controller);
+}
+
+#endif
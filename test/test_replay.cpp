@@ -0,0 +1,229 @@
+#ifdef NATIVE
+
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#include <controller.h>
+#include "SimHardware.h"
+#include "TestSetup.h"
+
+#define ZONES 4
+#define PULSES_PER_SECOND 5
+
+struct Recording {
+  std::vector<uint8_t> trace;
+  uint32_t passes;
+  uint32_t decisions;
+  int counters[ZONES + 1]; // irrigations per zone at the end
+};
+
+// Settings that aren't part of the TRACE_BEGIN record, shared by recording
+// and replay like they would be by the sketch and the replay runner
+static void configure(Irrigation &irrigation) {
+  setupPlots(irrigation, ZONES);
+  irrigation.schedule.addBlackoutWindow(11 * 60, 15 * 60);
+  irrigation.schedule.setMasterDelay(5);
+  irrigation.flow.setPulsesPerLiter(0, 100);
+  irrigation.flow.setTargetVolume(2, 1.0);
+}
+
+// Run the controller against a simulated greenhouse and keep the trace it
+// records, the same one the sketch writes when built with RECORD_TRACE
+static void recordSeason(uint32_t days, Recording &recording) {
+  Controller<SimHardware> controller;
+  SimHardware &sim = controller.hardware;
+  float raw[ZONES + 1] = { 0, 320, 350, 380, 410 };
+  float pulses = 0;
+
+  // The beds dry out at different rates and wet up while their valve and
+  // the master valve are open
+  sim.start = MONDAY;
+  sim.onSleep = [&](uint16_t ms) {
+    float seconds = ms / 1000.0;
+    for (uint8_t zone = 1; zone <= ZONES; zone++) {
+      raw[zone] -= seconds * zone / 1800.0;
+      if (sim.watering(zone)) {
+        raw[zone] += seconds * 0.8;
+        pulses += seconds * PULSES_PER_SECOND;
+      }
+      sim.moisture[zone] = raw[zone];
+    }
+    for (; pulses >= 1; pulses--) controller.irrigation.flow.pulse(0);
+  };
+  for (uint8_t zone = 1; zone <= ZONES; zone++) sim.moisture[zone] = raw[zone];
+
+  recording.passes = 0;
+  recording.decisions = 0;
+
+  configure(controller.irrigation);
+  controller.begin();
+
+  while (sim.now() < MONDAY + days * SCHEDULE_SECONDS_PER_DAY) {
+    ScheduleEvent event;
+    bool first = true;
+    while (controller.step(event)) {
+      if (first) recording.passes++;
+      if (event.type != EVENT_SAMPLE) recording.decisions++;
+      first = false;
+    }
+    controller.idle();
+  }
+  for (uint8_t zone = 1; zone <= ZONES; zone++) recording.counters[zone] = controller.irrigation.counter(zone);
+  recording.trace.swap(sim.trace);
+}
+
+void test_replay_reproduces_recorded_decisions(void) {
+  Recording recording;
+  recordSeason(14, recording);
+  TEST_ASSERT_GREATER_THAN(100, recording.decisions);
+
+  Irrigation irrigation;
+  configure(irrigation);
+  ReplayResult result;
+
+  TEST_ASSERT_TRUE(replayTrace(&recording.trace[0], recording.trace.size(), irrigation, result));
+  TEST_ASSERT_EQUAL(0, result.mismatches);
+  TEST_ASSERT_EQUAL(-1, result.firstMismatch);
+  TEST_ASSERT_EQUAL(recording.passes, result.passes);
+  TEST_ASSERT_EQUAL(recording.decisions, result.decisions);
+}
+
+void test_replay_detects_changed_decision(void) {
+  Recording recording;
+  recordSeason(2, recording);
+
+  // Make the first set of readings say every zone is wet
+  TraceRecord record;
+  uint32_t offset = 0;
+  uint8_t used;
+  while ((used = readTraceRecord(&recording.trace[offset], recording.trace.size() - offset, record)) > 0) {
+    if (record.type == TRACE_INPUTS) break;
+    offset += used;
+  }
+  TEST_ASSERT_EQUAL(TRACE_INPUTS, record.type);
+  for (uint8_t zone = 1; zone <= ZONES; zone++) {
+    recording.trace[offset + 6 + 2 * (zone - 1)] = 0xFF;
+    recording.trace[offset + 7 + 2 * (zone - 1)] = 0x03;
+  }
+
+  Irrigation irrigation;
+  configure(irrigation);
+  ReplayResult result;
+
+  TEST_ASSERT_FALSE(replayTrace(&recording.trace[0], recording.trace.size(), irrigation, result));
+  TEST_ASSERT_EQUAL(1, result.mismatches);
+  TEST_ASSERT_GREATER_THAN((int32_t)offset, result.firstMismatch);
+}
+
+// The device rebooted after two days and started over, appending to the
+// same trace. The second boot must not inherit the first one's fault
+// history or counters
+void test_replay_starts_over_on_every_boot(void) {
+  Recording first;
+  Recording second;
+  recordSeason(2, first);
+  recordSeason(3, second);
+  std::vector<uint8_t> trace(first.trace);
+  trace.insert(trace.end(), second.trace.begin(), second.trace.end());
+
+  Irrigation irrigation;
+  configure(irrigation);
+  ReplayResult result;
+
+  TEST_ASSERT_TRUE(replayTrace(&trace[0], trace.size(), irrigation, result));
+  TEST_ASSERT_EQUAL(first.passes + second.passes, result.passes);
+  TEST_ASSERT_EQUAL(first.decisions + second.decisions, result.decisions);
+  for (uint8_t zone = 1; zone <= ZONES; zone++) TEST_ASSERT_EQUAL(second.counters[zone], irrigation.counter(zone));
+}
+
+// Power was lost while the last record was being written
+void test_replay_reports_truncated_trace(void) {
+  Recording recording;
+  recordSeason(2, recording);
+
+  TraceRecord record;
+  uint32_t offset = 0;
+  uint32_t last = 0;
+  uint8_t used;
+  while ((used = readTraceRecord(&recording.trace[offset], recording.trace.size() - offset, record)) > 0) {
+    last = offset;
+    offset += used;
+  }
+  TEST_ASSERT_EQUAL(recording.trace.size(), offset);
+
+  Irrigation irrigation;
+  configure(irrigation);
+  ReplayResult result;
+
+  TEST_ASSERT_FALSE(replayTrace(&recording.trace[0], offset - 1, irrigation, result));
+  TEST_ASSERT_EQUAL(0, result.mismatches);
+  TEST_ASSERT_EQUAL((int32_t)last, result.truncatedAt);
+}
+
+void test_replay_throughput(void) {
+  Recording recording;
+  recordSeason(60, recording);
+
+  uint32_t passes = 0;
+  uint32_t rounds = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  double elapsed;
+  do {
+    Irrigation irrigation;
+    configure(irrigation);
+    ReplayResult result;
+    TEST_ASSERT_TRUE(replayTrace(&recording.trace[0], recording.trace.size(), irrigation, result));
+    passes += result.passes;
+    rounds++;
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  } while (elapsed < 0.2);
+
+  char message[128];
+  snprintf(message, sizeof(message), "Replayed %u x 60 days (%u bytes of trace): %.0f cycles/s",
+           (unsigned)rounds, (unsigned)recording.trace.size(), passes / elapsed);
+  TEST_MESSAGE(message);
+}
+
+// Replay a trace pulled off a device's SD card:
+//   IRRIGATION_TRACE=path/to/TRACE.BIN pio test -e native
+// Only the settings in the trace are applied, so traces from a device with
+// watering windows, priorities or flow targets set need those added here
+void test_replay_field_trace(void) {
+  const char *path = getenv("IRRIGATION_TRACE");
+  if (path == NULL) return;
+
+  FILE *file = fopen(path, "rb");
+  TEST_ASSERT_TRUE(file != NULL);
+  std::vector<uint8_t> trace;
+  uint8_t buffer[4096];
+  size_t count;
+  while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) trace.insert(trace.end(), buffer, buffer + count);
+  fclose(file);
+  TEST_ASSERT_GREATER_THAN(0, trace.size());
+
+  Irrigation irrigation;
+  ReplayResult result;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  bool matched = replayTrace(&trace[0], trace.size(), irrigation, result);
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  char message[200];
+  snprintf(message, sizeof(message), "%s: %u records, %u decisions, first mismatch at byte %d, cut short at byte %d, %.0f cycles/s",
+           path, (unsigned)result.records, (unsigned)result.decisions, (int)result.firstMismatch, (int)result.truncatedAt,
+           elapsed > 0 ? result.passes / elapsed : 0.0);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_TRUE(matched);
+}
+
+void run_replay_tests(void) {
+  RUN_TEST(test_replay_reproduces_recorded_decisions);
+  RUN_TEST(test_replay_detects_changed_decision);
+  RUN_TEST(test_replay_starts_over_on_every_boot);
+  RUN_TEST(test_replay_reports_truncated_trace);
+  RUN_TEST(test_replay_throughput);
+  RUN_TEST(test_replay_field_trace);
+}
+
+#endif
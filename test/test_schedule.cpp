@@ -0,0 +1,248 @@
+#ifdef NATIVE
+
+#include <unity.h>
+#include <schedule.h>
+#include "TestSetup.h"
+
+#define HOURS(h) ((h) * 3600UL)
+#define WEEK (7 * SCHEDULE_SECONDS_PER_DAY)
+
+struct SimulatedWeek {
+  uint32_t samples;
+  uint32_t opens[SCHEDULE_MAX_ZONES + 1];
+  uint32_t masterOpens;
+  uint32_t masterCloses;
+  uint32_t opensInBlackout;
+  uint32_t wakeups;
+};
+
+// Jump from one due event to the next like the sketch does when it idles,
+// asking for water on every sample for the zones in 'thirsty'
+static void simulate(Schedule &schedule, uint32_t from, uint32_t to, uint16_t thirsty, SimulatedWeek &week) {
+  week = SimulatedWeek();
+  schedule.begin(from);
+  uint32_t now = from;
+  while (now < to) {
+    ScheduleEvent event;
+    week.wakeups++;
+    while (schedule.poll(now, event)) {
+      if (event.type == EVENT_SAMPLE) {
+        week.samples++;
+        for (uint8_t zone = 1; zone <= SCHEDULE_MAX_ZONES; zone++) {
+          if (thirsty & (1 << zone)) schedule.request(zone, now);
+        }
+      }
+      if (event.type == EVENT_ZONE_OPEN) {
+        week.opens[event.zone]++;
+        if (schedule.isBlackedOut(event.at)) week.opensInBlackout++;
+      }
+      if (event.type == EVENT_MASTER_OPEN) week.masterOpens++;
+      if (event.type == EVENT_MASTER_CLOSE) week.masterCloses++;
+    }
+    now = schedule.nextDue();
+  }
+}
+
+void test_schedule_samples_every_interval_for_a_week(void) {
+  Schedule schedule;
+  SimulatedWeek week;
+  schedule.setSampleInterval(1800);
+
+  simulate(schedule, MONDAY, MONDAY + WEEK, 0, week);
+
+  TEST_ASSERT_EQUAL(WEEK / 1800, week.samples);
+  // Nothing but the sample is ever queued, so the controller only wakes up
+  // when a sample is due
+  TEST_ASSERT_EQUAL(week.samples, week.wakeups);
+  TEST_ASSERT_EQUAL(MONDAY + WEEK, schedule.nextDue());
+}
+
+void test_schedule_never_opens_inside_blackout_window(void) {
+  Schedule schedule;
+  SimulatedWeek week;
+  schedule.setSampleInterval(1800);
+  schedule.setDuration(1, 30);
+  schedule.addBlackoutWindow(11 * 60, 15 * 60);
+
+  simulate(schedule, MONDAY, MONDAY + WEEK, (1 << 1), week);
+
+  TEST_ASSERT_EQUAL(0, week.opensInBlackout);
+  // 8 of the 48 daily samples fall inside 11:00 - 15:00. Their requests fold
+  // into a single run at 15:00, which also covers the 15:00 sample
+  TEST_ASSERT_EQUAL(7 * (48 - 8), week.opens[1]);
+}
+
+void test_schedule_defers_request_to_end_of_window(void) {
+  Schedule schedule;
+  schedule.setSampleInterval(SCHEDULE_SECONDS_PER_DAY);
+  schedule.setMasterDelay(5);
+  schedule.setDuration(3, 60);
+  schedule.addBlackoutWindow(11 * 60, 15 * 60);
+  schedule.begin(MONDAY);
+
+  // Would run into the window, so the master valve opens at 15:00 and the
+  // zone follows after the master delay
+  TEST_ASSERT_TRUE(schedule.request(3, MONDAY + HOURS(11) - 30));
+
+  ScheduleEvent event;
+  TEST_ASSERT_TRUE(schedule.poll(MONDAY, event));
+  TEST_ASSERT_EQUAL(EVENT_SAMPLE, event.type);
+  TEST_ASSERT_EQUAL(MONDAY + HOURS(15), schedule.nextDue());
+
+  TEST_ASSERT_TRUE(schedule.poll(MONDAY + HOURS(15), event));
+  TEST_ASSERT_EQUAL(EVENT_MASTER_OPEN, event.type);
+  TEST_ASSERT_EQUAL(MONDAY + HOURS(15) + 5, schedule.nextDue());
+  TEST_ASSERT_TRUE(schedule.poll(MONDAY + HOURS(15) + 5, event));
+  TEST_ASSERT_EQUAL(EVENT_ZONE_OPEN, event.type);
+  TEST_ASSERT_EQUAL(3, event.zone);
+  TEST_ASSERT_EQUAL(3, schedule.openZone());
+}
+
+void test_schedule_skips_blackout_days(void) {
+  Schedule schedule;
+  SimulatedWeek week;
+  schedule.setSampleInterval(3600);
+  schedule.setBlackoutDays(DAY_BIT(0) | DAY_BIT(6));
+
+  TEST_ASSERT_EQUAL(1, Schedule::dayOfTheWeek(MONDAY));
+  TEST_ASSERT_TRUE(schedule.isBlackedOut(MONDAY - 1));
+  TEST_ASSERT_FALSE(schedule.isBlackedOut(MONDAY));
+
+  simulate(schedule, MONDAY, MONDAY + WEEK, (1 << 2), week);
+
+  TEST_ASSERT_EQUAL(7 * 24, week.samples);
+  TEST_ASSERT_EQUAL(5 * 24, week.opens[2]);
+  TEST_ASSERT_EQUAL(0, week.opensInBlackout);
+}
+
+void test_schedule_handles_window_across_midnight(void) {
+  Schedule schedule;
+  schedule.addBlackoutWindow(22 * 60, 6 * 60);
+
+  TEST_ASSERT_TRUE(schedule.isBlackedOut(MONDAY + HOURS(23)));
+  TEST_ASSERT_TRUE(schedule.isBlackedOut(MONDAY + HOURS(2)));
+  TEST_ASSERT_FALSE(schedule.isBlackedOut(MONDAY + HOURS(12)));
+  TEST_ASSERT_EQUAL(MONDAY + SCHEDULE_SECONDS_PER_DAY + HOURS(6), schedule.nextAllowed(MONDAY + HOURS(21) + 1800, 3600));
+}
+
+void test_schedule_runs_zones_by_priority_behind_one_master_open(void) {
+  Schedule schedule;
+  schedule.setMasterDelay(10);
+  schedule.setPriority(4, 1);
+  schedule.setPriority(5, 9);
+  schedule.begin(MONDAY);
+
+  ScheduleEvent event;
+  schedule.poll(MONDAY, event);
+
+  // Requests made before the next poll() start by priority, whatever order
+  // they came in
+  schedule.request(2, MONDAY);
+  schedule.request(4, MONDAY);
+  schedule.request(5, MONDAY);
+  TEST_ASSERT_FALSE(schedule.request(5, MONDAY));
+
+  uint8_t order[3];
+  uint8_t opened = 0, masterOpens = 0, masterCloses = 0;
+  uint32_t now = MONDAY;
+  uint32_t lastClose = 0;
+  while (now < MONDAY + 1800) {
+    while (schedule.poll(now, event)) {
+      if (event.type == EVENT_ZONE_OPEN) order[opened++] = event.zone;
+      if (event.type == EVENT_ZONE_CLOSE) lastClose = event.at;
+      if (event.type == EVENT_MASTER_OPEN) masterOpens++;
+      if (event.type == EVENT_MASTER_CLOSE) {
+        masterCloses++;
+        TEST_ASSERT_EQUAL(lastClose, event.at);
+      }
+    }
+    now = schedule.nextDue();
+  }
+
+  TEST_ASSERT_EQUAL(3, opened);
+  TEST_ASSERT_EQUAL(5, order[0]);
+  TEST_ASSERT_EQUAL(4, order[1]);
+  TEST_ASSERT_EQUAL(2, order[2]);
+  TEST_ASSERT_EQUAL(1, masterOpens);
+  TEST_ASSERT_EQUAL(1, masterCloses);
+  TEST_ASSERT_EQUAL(MONDAY + 10 + 3 * 30, lastClose);
+}
+
+void test_schedule_close_early_starts_next_zone(void) {
+  Schedule schedule;
+  schedule.setSampleInterval(SCHEDULE_SECONDS_PER_DAY);
+  schedule.setDuration(1, 300);
+  schedule.setDuration(2, 300);
+  schedule.begin(MONDAY);
+
+  ScheduleEvent event;
+  schedule.poll(MONDAY, event);
+  schedule.request(1, MONDAY);
+  schedule.request(2, MONDAY);
+
+  // Can't close a zone before it is open
+  TEST_ASSERT_FALSE(schedule.closeEarly(1, MONDAY));
+  schedule.poll(MONDAY, event);
+  schedule.poll(MONDAY, event);
+  TEST_ASSERT_EQUAL(EVENT_ZONE_OPEN, event.type);
+  TEST_ASSERT_EQUAL(MONDAY + 300, schedule.nextDue());
+
+  TEST_ASSERT_TRUE(schedule.closeEarly(1, MONDAY + 42));
+  TEST_ASSERT_FALSE(schedule.closeEarly(2, MONDAY + 42));
+  TEST_ASSERT_EQUAL(MONDAY + 42, schedule.nextDue());
+  TEST_ASSERT_TRUE(schedule.poll(MONDAY + 42, event));
+  TEST_ASSERT_EQUAL(EVENT_ZONE_CLOSE, event.type);
+  TEST_ASSERT_TRUE(schedule.poll(MONDAY + 42, event));
+  TEST_ASSERT_EQUAL(EVENT_ZONE_OPEN, event.type);
+  TEST_ASSERT_EQUAL(2, event.zone);
+  TEST_ASSERT_EQUAL(MONDAY + 342, schedule.nextDue());
+}
+
+void test_schedule_cancel_drops_queued_zone_and_closes_open_one(void) {
+  Schedule schedule;
+  schedule.setSampleInterval(SCHEDULE_SECONDS_PER_DAY);
+  schedule.setMasterDelay(10);
+  schedule.setDuration(1, 300);
+  schedule.setDuration(2, 300);
+  schedule.addBlackoutWindow(0, 60);
+  schedule.begin(MONDAY);
+
+  ScheduleEvent event;
+  schedule.poll(MONDAY, event);
+  schedule.request(1, MONDAY);
+  schedule.request(2, MONDAY);
+  TEST_ASSERT_FALSE(schedule.poll(MONDAY, event));
+  TEST_ASSERT_EQUAL(MONDAY + HOURS(1), schedule.nextDue());
+
+  // Zone 1 is waiting for the end of the blackout, zone 2 takes its place
+  schedule.cancel(1, MONDAY + 60);
+  TEST_ASSERT_FALSE(schedule.isPending(1));
+  TEST_ASSERT_TRUE(schedule.poll(MONDAY + HOURS(1), event));
+  TEST_ASSERT_EQUAL(EVENT_MASTER_OPEN, event.type);
+  TEST_ASSERT_FALSE(schedule.poll(MONDAY + HOURS(1), event));
+  TEST_ASSERT_TRUE(schedule.poll(MONDAY + HOURS(1) + 10, event));
+  TEST_ASSERT_EQUAL(EVENT_ZONE_OPEN, event.type);
+  TEST_ASSERT_EQUAL(2, event.zone);
+
+  // An open zone is closed right away, and the master valve after it
+  schedule.cancel(2, MONDAY + HOURS(1) + 100);
+  TEST_ASSERT_TRUE(schedule.poll(MONDAY + HOURS(1) + 100, event));
+  TEST_ASSERT_EQUAL(EVENT_ZONE_CLOSE, event.type);
+  TEST_ASSERT_EQUAL(2, event.zone);
+  TEST_ASSERT_TRUE(schedule.poll(MONDAY + HOURS(1) + 100, event));
+  TEST_ASSERT_EQUAL(EVENT_MASTER_CLOSE, event.type);
+  TEST_ASSERT_EQUAL(MONDAY + SCHEDULE_SECONDS_PER_DAY, schedule.nextDue());
+}
+
+void run_schedule_tests(void) {
+  RUN_TEST(test_schedule_samples_every_interval_for_a_week);
+  RUN_TEST(test_schedule_never_opens_inside_blackout_window);
+  RUN_TEST(test_schedule_defers_request_to_end_of_window);
+  RUN_TEST(test_schedule_skips_blackout_days);
+  RUN_TEST(test_schedule_handles_window_across_midnight);
+  RUN_TEST(test_schedule_runs_zones_by_priority_behind_one_master_open);
+  RUN_TEST(test_schedule_close_early_starts_next_zone);
+  RUN_TEST(test_schedule_cancel_drops_queued_zone_and_closes_open_one);
+}
+
+#endif
@@ -0,0 +1,266 @@
+#ifdef NATIVE
+
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <irrigation.h>
+#include "WorkStealingPool.h"
+#include "TestSetup.h"
+
+#define SEASON_DAYS 60
+#define ZONES 4
+
+// The beds are modelled in the controller's VWC units (raw reading / 10).
+// Below SWEEP_STRESS the plants are stressed, above SWEEP_CAPACITY water
+// drains out of the container and is lost. A bed dries out more slowly the
+// closer it gets to SWEEP_RESIDUAL, the water the plants can't take up
+#define SWEEP_STRESS 30.0
+#define SWEEP_CAPACITY 50.0
+#define SWEEP_RESIDUAL 10.0
+// VWC gained and liters used per second a valve is open
+#define SWEEP_WETTING 0.1
+#define SWEEP_LITERS_PER_SECOND 0.05
+// Longest step the bed model takes between two events (seconds)
+#define SWEEP_STEP 60
+
+// What an hour of stress and a valve actuation are worth in liters, to
+// rank configurations on one number
+#define SWEEP_STRESS_WEIGHT 2.0
+#define SWEEP_ACTUATION_WEIGHT 0.05
+
+struct SweepConfig {
+  float threshold;
+  uint32_t irrigationTime;
+  uint32_t runTime;
+};
+
+struct SeasonScore {
+  float liters;
+  float hoursBelow;   // summed over the zones
+  uint32_t actuations;
+  uint8_t faults;     // zones the fault detector disabled
+  float cost;
+};
+
+static uint32_t mix(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7FEB352D;
+  x ^= x >> 15;
+  x *= 0x846CA68B;
+  x ^= x >> 16;
+  return x;
+}
+
+// Drying power of the weather at 'at', the same for every configuration:
+// day to day between 0.6 and 1.4, following the sun during the day
+static float evaporation(uint32_t at) {
+  uint32_t seconds = at - MONDAY;
+  float day = 0.6 + 0.8 * (mix(seconds / SCHEDULE_SECONDS_PER_DAY) % 1000) / 1000.0;
+  float hour = (seconds % SCHEDULE_SECONDS_PER_DAY) / 3600.0;
+  float sun = hour > 6 && hour < 18 ? sin(M_PI * (hour - 6) / 12) : 0;
+  return day * (0.2 + 1.8 * sun);
+}
+
+// Run a season of four beds that dry out at different rates through the
+// Irrigation decisions. Time jumps from event to event (at most SWEEP_STEP
+// at a time) instead of sleeping in flow meter slices like the controller,
+// so a season takes well under a millisecond
+static SeasonScore runSeason(const SweepConfig &config) {
+  Irrigation irrigation;
+  setupPlots(irrigation, ZONES, config.threshold, config.irrigationTime, config.runTime);
+
+  const float drying[ZONES + 1] = { 0, 0.6, 0.8, 1.0, 1.2 }; // VWC per hour when wet
+  float vwc[ZONES + 1] = { 0, 45, 45, 45, 45 };
+  bool open[ZONES + 1] = { false };
+  bool master = false;
+  uint32_t noise = 1;
+  SeasonScore score = { 0, 0, 0, 0, 0 };
+
+  uint32_t now = MONDAY;
+  uint32_t end = MONDAY + SEASON_DAYS * SCHEDULE_SECONDS_PER_DAY;
+  irrigation.begin(now);
+  while (now < end) {
+    ScheduleEvent event;
+    while (irrigation.poll(now, event)) {
+      switch (event.type) {
+        case EVENT_SAMPLE: {
+          RawInputs inputs;
+          inputs.at = now;
+          inputs.humidity = 60;
+          inputs.temperature = 25;
+          for (uint8_t zone = 0; zone <= IRRIGATION_MAX_ZONES; zone++) {
+            noise = noise * 1103515245 + 12345;
+            inputs.sensorValue[zone] = zone >= 1 && zone <= ZONES ? vwc[zone] * 10 + (int)((noise >> 16) % 5) - 2 : 0;
+          }
+          irrigation.sample(inputs);
+          break;
+        }
+        case EVENT_MASTER_OPEN:
+        case EVENT_MASTER_CLOSE:
+          master = event.type == EVENT_MASTER_OPEN;
+          score.actuations++;
+          break;
+        case EVENT_ZONE_OPEN:
+        case EVENT_ZONE_CLOSE:
+          open[event.zone] = event.type == EVENT_ZONE_OPEN;
+          score.actuations++;
+          break;
+      }
+    }
+
+    uint32_t next = irrigation.schedule.nextDue();
+    if (next > now + SWEEP_STEP) next = now + SWEEP_STEP;
+    if (next <= now) next = now + 1;
+    float seconds = next - now;
+    float weather = evaporation(now);
+    for (uint8_t zone = 1; zone <= ZONES; zone++) {
+      vwc[zone] -= seconds / 3600 * drying[zone] * weather * (vwc[zone] - SWEEP_RESIDUAL) / (SWEEP_CAPACITY - SWEEP_RESIDUAL);
+      if (master && open[zone]) {
+        vwc[zone] += seconds * SWEEP_WETTING;
+        score.liters += seconds * SWEEP_LITERS_PER_SECOND;
+      }
+      if (vwc[zone] > SWEEP_CAPACITY) vwc[zone] = SWEEP_CAPACITY;
+      if (vwc[zone] < SWEEP_STRESS) score.hoursBelow += seconds / 3600;
+    }
+    now = next;
+  }
+
+  for (uint8_t zone = 1; zone <= ZONES; zone++) score.faults += irrigation.faults.isDisabled(zone);
+  score.cost = score.liters + score.hoursBelow * SWEEP_STRESS_WEIGHT + score.actuations * SWEEP_ACTUATION_WEIGHT;
+  return score;
+}
+
+// Spread 'count' configurations evenly over the ranges worth trying. The
+// first one is the sketch's default for plots 2 - 14
+static std::vector<SweepConfig> sweepConfigs(size_t count) {
+  std::vector<SweepConfig> configs(count);
+  for (size_t n = 0; n < count; n++) {
+    // Additive recurrence, so any count covers the ranges evenly
+    float a = fmod(0.5 + n * 0.7548776662, 1.0);
+    float b = fmod(0.5 + n * 0.5698402910, 1.0);
+    float c = fmod(0.5 + n * 0.3605471619, 1.0);
+    configs[n].threshold = n == 0 ? 0.4 : 20 + 30 * a;
+    configs[n].irrigationTime = n == 0 ? 30 : 10 + 290 * b;
+    configs[n].runTime = n == 0 ? 1800 : 300 + (uint32_t)(12 * c) * 300;
+  }
+  return configs;
+}
+
+static std::vector<SeasonScore> sweep(const std::vector<SweepConfig> &configs, WorkStealingPool &pool) {
+  std::vector<SeasonScore> scores(configs.size());
+  pool.run(configs.size(), [&](size_t index, unsigned) {
+    scores[index] = runSeason(configs[index]);
+  });
+  return scores;
+}
+
+static std::vector<size_t> rank(const std::vector<SeasonScore> &scores) {
+  std::vector<size_t> order(scores.size());
+  for (size_t n = 0; n < order.size(); n++) order[n] = n;
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return scores[a].cost < scores[b].cost;
+  });
+  return order;
+}
+
+void test_sweep_pool_runs_every_job_once(void) {
+  const size_t count = 400;
+  std::vector<std::atomic<int> > runs(count);
+  std::atomic<bool> stolen(false);
+  for (size_t n = 0; n < count; n++) runs[n] = 0;
+
+  // Worker 0 blocks on its first job until another worker has stolen from
+  // its queue, which only works if the idle workers go looking for jobs
+  WorkStealingPool pool(4);
+  pool.run(count, [&](size_t index, unsigned worker) {
+    runs[index]++;
+    if (index < count / 4 && worker != 0) stolen = true;
+    if (index == count / 4 - 1) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      while (!stolen && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) std::this_thread::yield();
+    }
+  });
+
+  for (size_t n = 0; n < count; n++) TEST_ASSERT_EQUAL(1, (int)runs[n]);
+  TEST_ASSERT_TRUE(stolen);
+  TEST_ASSERT_GREATER_THAN(0, pool.steals);
+}
+
+void test_sweep_is_the_same_on_any_number_of_threads(void) {
+  std::vector<SweepConfig> configs = sweepConfigs(48);
+  WorkStealingPool one(1);
+  WorkStealingPool many(4);
+  std::vector<SeasonScore> serial = sweep(configs, one);
+  std::vector<SeasonScore> parallel = sweep(configs, many);
+  for (size_t n = 0; n < configs.size(); n++) {
+    TEST_ASSERT_EQUAL_FLOAT(serial[n].liters, parallel[n].liters);
+    TEST_ASSERT_EQUAL_FLOAT(serial[n].hoursBelow, parallel[n].hoursBelow);
+    TEST_ASSERT_EQUAL(serial[n].actuations, parallel[n].actuations);
+  }
+}
+
+void test_sweep_ranks_starving_and_flooding_below_sensible(void) {
+  SweepConfig starved = { 0.4, 30, 1800 };  // the sketch's default, never irrigates
+  SweepConfig sensible = { 35, 60, 1800 };
+  SweepConfig flooding = { 45, 300, 300 }; // not at capacity, or the beds can't show the irrigation
+  SeasonScore s = runSeason(starved);
+  SeasonScore g = runSeason(sensible);
+  SeasonScore f = runSeason(flooding);
+
+  TEST_ASSERT_EQUAL(0, s.actuations);
+  TEST_ASSERT_GREATER_THAN(SEASON_DAYS * 24, (int)s.hoursBelow);
+  TEST_ASSERT_TRUE(g.hoursBelow < 1);
+  TEST_ASSERT_EQUAL(0, g.faults);
+  TEST_ASSERT_EQUAL(0, f.faults);
+  TEST_ASSERT_TRUE(f.liters > 2 * g.liters);
+  TEST_ASSERT_TRUE(g.cost < f.cost);
+  TEST_ASSERT_TRUE(g.cost < s.cost);
+}
+
+// Run a full sweep and print the best configurations:
+//   IRRIGATION_SWEEP=10000 pio test -e native
+// Skipped unless IRRIGATION_SWEEP is set, so the normal test run stays quick
+void test_sweep_ranking(void) {
+  const char *count = getenv("IRRIGATION_SWEEP");
+  if (count == NULL) return;
+  std::vector<SweepConfig> configs = sweepConfigs(atoi(count));
+  WorkStealingPool pool;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<SeasonScore> scores = sweep(configs, pool);
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::vector<size_t> order = rank(scores);
+
+  char message[160];
+  snprintf(message, sizeof(message), "Swept %u configurations x %u days on %u threads in %.2f s (%.0f seasons/s, %u steals)",
+           (unsigned)configs.size(), SEASON_DAYS, pool.threads(), elapsed, configs.size() / elapsed,
+           (unsigned)pool.steals);
+  TEST_MESSAGE(message);
+  for (size_t n = 0; n < order.size() && n < 10; n++) {
+    const SweepConfig &c = configs[order[n]];
+    const SeasonScore &s = scores[order[n]];
+    snprintf(message, sizeof(message), "#%u threshold %.1f, IrrigTime %u s, RunTime %u s: %.1f L, %.1f h below %.0f, %u actuations, %u faults",
+             (unsigned)n + 1, c.threshold, (unsigned)c.irrigationTime, (unsigned)c.runTime, s.liters, s.hoursBelow,
+             SWEEP_STRESS, (unsigned)s.actuations, (unsigned)s.faults);
+    TEST_MESSAGE(message);
+  }
+  // The sketch's default should be in the worse half
+  size_t position = std::find(order.begin(), order.end(), 0) - order.begin();
+  snprintf(message, sizeof(message), "Sketch default (threshold 0.4): #%u", (unsigned)position + 1);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_GREATER_THAN(configs.size() / 2, position);
+}
+
+void run_sweep_tests(void) {
+  RUN_TEST(test_sweep_pool_runs_every_job_once);
+  RUN_TEST(test_sweep_is_the_same_on_any_number_of_threads);
+  RUN_TEST(test_sweep_ranks_starving_and_flooding_below_sensible);
+  RUN_TEST(test_sweep_ranking);
+}
+
+#endif
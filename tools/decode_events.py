@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+"""Turn the binary event records the controller sends into text.
+
+    $ python3 tools/decode_events.py /media/sdcard/EVENTS.BIN
+    $ python3 tools/decode_events.py --csv /media/sdcard/EVENTS.BIN > events.csv
+    $ python3 tools/decode_events.py < /dev/ttyACM0
+
+The events and their messages are read from lib/irrigation/event_catalog.h,
+the fault names from lib/irrigation/fault_detector.cpp. Every record is the
+marker 0xE7, the event ID, the time (seconds since 2000-01-01), the arguments
+and a checksum (see lib/irrigation/events.h). Anything that isn't a valid
+record is skipped, so the serial port can be read from the middle of a stream.
+Records are decoded and printed as they come in, so piping the serial port in
+shows the events live.
+"""
+import datetime
+import os
+import re
+import struct
+import sys
+
+LIB = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'lib', 'irrigation')
+MARKER = 0xE7
+HEADER = 6
+EPOCH = datetime.datetime(2000, 1, 1)
+FORMATS = {'B': '<B', 'F': '<B', 'H': '<H', 'I': '<I', 'f': '<f'}
+
+
+def load_catalog():
+    with open(os.path.join(LIB, 'event_catalog.h')) as f:
+        events = re.findall(r'^EVENT\((\w+),\s*"(\w*)",\s*"(.*)"\)\s*$', f.read(), re.M)
+    return {n + 1: event for n, event in enumerate(events)}
+
+
+def load_faults():
+    with open(os.path.join(LIB, 'fault_detector.h')) as f:
+        header = f.read()
+    with open(os.path.join(LIB, 'fault_detector.cpp')) as f:
+        names = dict(re.findall(r'(FAULT_\w+)_NAME\[\] PROGMEM = "(.*)";', f.read()))
+    codes = re.findall(r'^\s*(FAULT_\w+)\s*,?', header[header.index('enum'):], re.M)
+    return {n: names.get(code, 'none') for n, code in enumerate(codes)}
+
+
+def records(stream, catalog):
+    """Yield the records in 'stream' as soon as each one is complete."""
+    data = bytearray()
+    for chunk in iter(lambda: stream.read1(4096), b''):
+        data += chunk
+        offset = 0
+        while offset + HEADER < len(data):
+            event = catalog.get(data[offset + 1]) if data[offset] == MARKER else None
+            if event:
+                size = HEADER + sum(struct.calcsize(FORMATS[c]) for c in event[1])
+                if offset + size + 1 > len(data):
+                    break  # wait for the rest of it
+                record = data[offset:offset + size + 1]
+                if sum(record[1:size]) & 0xFF == record[size]:
+                    args, position = [], HEADER
+                    for c in event[1]:
+                        args.append(struct.unpack_from(FORMATS[c], record, position)[0])
+                        position += struct.calcsize(FORMATS[c])
+                    at = struct.unpack_from('<I', record, 2)[0]
+                    yield EPOCH + datetime.timedelta(seconds=at), event, args
+                    offset += size + 1
+                    continue
+            offset += 1
+        del data[:offset]
+
+
+def render(event, args, faults):
+    values = [faults.get(a, 'none') if c == 'F' else '%.2f' % a if c == 'f' else str(a)
+              for c, a in zip(event[1], args)]
+    return re.sub(r'\{(\d)\}', lambda m: values[int(m.group(1))], event[2])
+
+
+if __name__ == '__main__':
+    arguments = sys.argv[1:]
+    csv = '--csv' in arguments
+    arguments = [a for a in arguments if a != '--csv']
+    stream = open(arguments[0], 'rb') if arguments else sys.stdin.buffer
+    catalog, faults = load_catalog(), load_faults()
+    for at, event, args in records(stream, catalog):
+        if csv:
+            values = ['%.6g' % a if c == 'f' else str(a) for c, a in zip(event[1], args)]
+            print(', '.join([at.strftime('%Y/%m/%d %H:%M:%S'), event[0]] + values), flush=True)
+        else:
+            print(at.strftime('%m/%d/%Y %H:%M:%S'), render(event, args, faults), flush=True)
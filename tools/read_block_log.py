@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""Print the data logged to LOG.BIN (built with -DLOG_CONTIGUOUS).
+
+    $ python3 tools/read_block_log.py /media/sdcard/LOG.BIN > log.txt
+
+Follows lib/irrigation/block_log.h: blocks 0 and 1 hold the commit record,
+then every data block has a 16 byte header (generation, index, sequence,
+bytes used, CRC) and its newest valid copy is either in its own slot or in
+the slot after it.
+"""
+import struct
+import sys
+
+BLOCK_SIZE = 512
+HEADER = 16
+MAGIC = 0x474F4C49
+DATA = 2
+
+
+def crc16(data, crc=0xFFFF):
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def commit(image, slot):
+    block = image[slot * BLOCK_SIZE:(slot + 1) * BLOCK_SIZE]
+    magic, generation, tail, sequence, crc = struct.unpack_from('<IIIIH', block)
+    if magic != MAGIC or crc16(block[:16]) != crc:
+        return None
+    return sequence, generation, tail
+
+
+def copy(image, slot, generation, index):
+    block = image[slot * BLOCK_SIZE:(slot + 1) * BLOCK_SIZE]
+    if len(block) < BLOCK_SIZE:
+        return None
+    gen, idx, sequence, used, crc = struct.unpack_from('<IIIHH', block)
+    if gen != generation or idx != index or used > BLOCK_SIZE - HEADER:
+        return None
+    data = block[HEADER:HEADER + used]
+    if crc16(data, crc16(block[:14])) != crc:
+        return None
+    return sequence, data
+
+
+def read(image):
+    commits = [c for c in (commit(image, 0), commit(image, 1)) if c]
+    if not commits:
+        raise SystemExit('no block log found')
+    generation = max(commits)[1]
+    blocks = len(image) // BLOCK_SIZE - DATA - 1
+    index = 0
+    while index < blocks:
+        copies = [c for c in (copy(image, DATA + index, generation, index),
+                              copy(image, DATA + index + 1, generation, index)) if c]
+        if not copies:
+            break
+        data = max(copies)[1]
+        yield data
+        if len(data) < BLOCK_SIZE - HEADER:
+            break
+        index += 1
+
+
+if __name__ == '__main__':
+    with open(sys.argv[1], 'rb') as f:
+        image = f.read()
+    for data in read(image):
+        sys.stdout.buffer.write(data)